@@ -1,6 +1,6 @@
 #include "application.hpp"
 
-Application::Application(std::unique_ptr<SPH> &&sph, const Bounds &_bounds): b{_bounds}, sph{std::move(sph)}, avgFrameTime{0}, frameTimeN{0} {
+Application::Application(std::unique_ptr<SPH> &&sph, const Bounds &_bounds): b{_bounds}, sph{std::move(sph)}, avgFrameTime{0}, frameTimeN{0}, stepN{0} {
 	cameraPos = {-2,2,.5};
 	glm::mat4x4 cameraView = lookAt(cameraPos, (b.max-b.min)/2.f, UP);
 	glm::mat4x4 projection = glm::perspective(70., 1., 0.1, 1000.);
@@ -45,9 +45,21 @@ void Application::draw() {
 }
 
 void Application::update() {
+	sph->collectHealth = healthLog && healthLog->due(stepN);
 	sph->update();
+	// the GPU step time of the backends is reported with a delay of a few frames
+	if(sph->collectHealth)
+		healthLog->record(stepN, sph->frameTime, sph->health);
+	if(surfaceWriter && surfaceWriter->due(stepN))
+		surfaceWriter->write(*sph, stepN);
+	++stepN;
 	if(frameTimeN == 20)
 		frameTimeN = 4;
 	avgFrameTime = (avgFrameTime*frameTimeN + sph->frameTime) / (frameTimeN + 1);
 	frameTimeN++;
+	if(exporter) {
+		sph->getParticles(exportPos, exportVel);
+		sph->getDensities(exportDensity);
+		exporter->publish(exportPos, exportVel, exportDensity);
+	}
 }
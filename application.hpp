@@ -10,6 +10,8 @@
 #define APPLICATION_HPP_20_01_07_21_40_12 
 #include <memory>
 #include "sph.hpp"
+#include "sharedState.hpp"
+#include "surface.hpp"
 
 /// Draw everything, call update, calculate avg frameTime
 class Application {
@@ -29,6 +31,14 @@ class Application {
 
 		float avgFrameTime;
 		unsigned frameTimeN;
+
+		std::unique_ptr<SharedStateWriter> exporter; /// may be null, publishes the state after every step
+		std::unique_ptr<HealthLog> healthLog; /// may be null
+		std::unique_ptr<SurfaceWriter> surfaceWriter; /// may be null, meshes the fluid surface every few steps
+		unsigned stepN; /// steps since the start
+		std::vector<vec3> exportPos;
+		std::vector<vec3> exportVel;
+		std::vector<float> exportDensity;
 };
 
 #endif /* APPLICATION_HPP_20_01_07_21_40_12 */
@@ -0,0 +1,204 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "benchmark.hpp"
+#include "scene.hpp"
+#include "sphRegistry.hpp"
+using namespace std;
+
+static atomic<unsigned long long> allocationN{0};
+
+// counts all the allocations in the program, the array and nothrow versions call this one
+void* operator new(size_t size) {
+	allocationN.fetch_add(1, memory_order_relaxed);
+	if(void* p = malloc(size ? size : 1))
+		return p;
+	throw bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	free(p);
+}
+
+unsigned long long heapAllocationN() {
+	return allocationN.load(memory_order_relaxed);
+}
+
+/// Hardware event counter of this process (perf events), the kernel may not allow it
+class PerfCounter {
+	public:
+		PerfCounter(uint32_t type, uint64_t config) {
+			perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = type;
+			attr.config = config;
+			attr.disabled = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		}
+		~PerfCounter() {
+			if(fd >= 0)
+				close(fd);
+		}
+		void start() {
+			if(fd >= 0) {
+				ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+				ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+			}
+		}
+		/// \return events since start, -1 if not available
+		long long stop() {
+			long long count;
+			if(fd < 0 || ioctl(fd, PERF_EVENT_IOC_DISABLE, 0) != 0 || read(fd, &count, sizeof(count)) != sizeof(count))
+				return -1;
+			return count;
+		}
+
+	private:
+		int fd;
+};
+
+/// storage bytes read and written by this process so far, false if the kernel does not provide the I/O accounting
+static bool storageIo(long long& readBytes, long long& writeBytes) {
+	ifstream f("/proc/self/io");
+	string key;
+	long long value;
+	readBytes = writeBytes = -1;
+	while(f >> key >> value) {
+		if(key == "read_bytes:")
+			readBytes = value;
+		else if(key == "write_bytes:")
+			writeBytes = value;
+	}
+	return readBytes >= 0 && writeBytes >= 0;
+}
+
+BenchmarkResult runBenchmark(SPH& sph, unsigned warmupStepN, unsigned stepN) {
+	for(unsigned i = 0; i < warmupStepN; ++i)
+		sph.update();
+	glFinish();
+	unsigned long long allocationsBegin = heapAllocationN();
+	double collisionTime = 0;
+	unsigned long long pressureIterations = 0;
+	unsigned long long savedBegin = sph.savedParticleUpdates;
+	unsigned long long dispatchN = 0;
+	unsigned long long movedBytes = 0;
+	unsigned long long ioBytes = 0;
+	double ioWaitTime = 0;
+	long long readBegin, writeBegin;
+	bool io = storageIo(readBegin, writeBegin);
+	PerfCounter l1dMisses(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+	PerfCounter llcMisses(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+	l1dMisses.start();
+	llcMisses.start();
+	auto begin = chrono::steady_clock::now();
+	for(unsigned i = 0; i < stepN; ++i) {
+		sph.update();
+		collisionTime += sph.collisionTime;
+		pressureIterations += sph.pressureIterations;
+		dispatchN += sph.dispatchN;
+		movedBytes += sph.movedBytes;
+		ioBytes += sph.ioBytes;
+		ioWaitTime += sph.ioWaitTime;
+	}
+	glFinish();
+	double t = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+	long long l1d = l1dMisses.stop();
+	long long llc = llcMisses.stop();
+	unsigned long long allocations = heapAllocationN() - allocationsBegin;
+	long long readEnd, writeEnd;
+	io = io && storageIo(readEnd, writeEnd);
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return {stepN, t/stepN, double(allocations)/stepN, collisionTime/stepN, double(pressureIterations)/stepN,
+		double(sph.savedParticleUpdates - savedBegin)/stepN, double(dispatchN)/stepN, double(movedBytes)/stepN, l1d < 0 ? -1 : double(l1d)/stepN, llc < 0 ? -1 : double(llc)/stepN,
+		double(ioBytes)/stepN, ioWaitTime/stepN, io ? double(readEnd-readBegin)/stepN : -1, io ? double(writeEnd-writeBegin)/stepN : -1, double(usage.ru_maxrss)*1024};
+}
+
+std::ostream& operator<<(std::ostream& s, const BenchmarkResult& r) {
+	s << "steps: " << r.stepN << "\n"
+		<< "avg step time: " << r.stepTime << " [ms]\n";
+	if(r.collisionTime > 0)
+		s << "avg collision time: " << r.collisionTime << " [ms]\n";
+	if(r.pressureIterations > 0)
+		s << "avg pressure iterations: " << r.pressureIterations << "\n";
+	if(r.savedParticleUpdates > 0)
+		s << "avg particle updates saved by local time stepping: " << r.savedParticleUpdates << "\n";
+	if(r.dispatches > 0)
+		s << "avg compute dispatches per step: " << r.dispatches << "\n"
+			<< "avg buffer traffic per step: " << r.movedBytes/1024/1024 << " [MiB] (estimate, without the neighbour reads)\n";
+	if(r.ioBytes > 0)
+		s << "avg particle data streamed per step: " << r.ioBytes/1024/1024 << " [MiB], " << r.ioBytes/1024/1024/(r.stepTime/1000) << " [MiB/s]\n"
+			<< "avg wait for the prefetch per step: " << r.ioWaitTime << " [ms]\n";
+	if(r.storageReadBytes >= 0)
+		s << "storage read/written per step: " << r.storageReadBytes/1024/1024 << " / " << r.storageWriteBytes/1024/1024 << " [MiB]\n";
+	s << "peak resident memory: " << r.peakResidentBytes/1024/1024 << " [MiB]\n";
+	if(r.l1dMisses >= 0)
+		s << "L1d read misses per step: " << r.l1dMisses << "\n";
+	if(r.llcMisses >= 0)
+		s << "last level cache misses per step: " << r.llcMisses << "\n";
+	if(r.l1dMisses < 0 && r.llcMisses < 0)
+		s << "cache misses: not available (perf events)\n";
+	return s << "heap allocations per step: " << r.allocationsPerStep << "\n";
+}
+
+bool runObstacleBenchmark(const Scene& scene, const SPHconfig& config, unsigned maxObstacleN, unsigned stepN) {
+	if(scene.obstacles.empty()) {
+		cerr << "The obstacle benchmark needs a scene with an obstacle\n";
+		return false;
+	}
+	const unsigned warmupStepN = 3;
+	ostringstream table;
+	table << "obstacles,triangles,bake_ms,step_ms,collision_ms\n";
+	for(unsigned obstacleN = 0; ; obstacleN = std::max(1u, 2*obstacleN)) {
+		obstacleN = std::min(obstacleN, maxObstacleN);
+		Scene s = scene;
+		s.obstacles.clear();
+		// the copies in the cells of a g^3 grid of the box, so that they do not overlap
+		unsigned g = 1;
+		while(g*g*g < obstacleN)
+			++g;
+		for(unsigned j = 0; j < obstacleN; ++j) {
+			Obstacle o = scene.obstacles[j % scene.obstacles.size()];
+			vec3 cell(j%g, j/g%g, j/(g*g));
+			o.scale /= g;
+			o.offset = cell*scene.boxSize/float(g) + o.offset/float(g);
+			s.obstacles.push_back(o);
+		}
+		Bounds b(scene.boxSize);
+		auto bakeBegin = chrono::steady_clock::now();
+		if(!s.bakeObstacles(b))
+			return false;
+		double bakeTime = chrono::duration<double, milli>(chrono::steady_clock::now() - bakeBegin).count();
+		SPHconfig c = config;
+		unique_ptr<SPH> sph = SPHregistry::instance().create(scene.backend, c, b);
+		if(!sph) {
+			cerr << "Unknown backend " << scene.backend << endl;
+			return false;
+		}
+		BenchmarkResult r = runBenchmark(*sph, warmupStepN, stepN);
+		table << obstacleN << "," << (b.obstacles ? b.obstacles->triangleN : 0) << "," << (obstacleN ? bakeTime : 0) << ","
+			<< r.stepTime << "," << r.collisionTime << "\n";
+		if(obstacleN == maxObstacleN)
+			break;
+	}
+	// the GPU has no separate collision pass, its cost is the growth of the timed update pass over the run without obstacles
+	cout << table.str();
+	return true;
+}
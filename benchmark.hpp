@@ -0,0 +1,47 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       benchmark.hpp
+ * \author     Ales Koblizek
+ * \date       2026/10/19
+ * \brief      Benchmark of the simulation step without drawing
+*/
+//----------------------------------------------------------------------------------------
+#ifndef BENCHMARK_HPP_26_10_19_09_41_27
+#define BENCHMARK_HPP_26_10_19_09_41_27 
+#include "sph.hpp"
+
+/// number of heap allocations (operator new) since the start of the program
+unsigned long long heapAllocationN();
+
+struct BenchmarkResult {
+	unsigned stepN;
+	double stepTime; /// average wall time of a step [ms]
+	double allocationsPerStep; /// average number of heap allocations per step
+	double collisionTime; /// average time of the collision handling [ms], 0 if the implementation does not measure it
+	double pressureIterations; /// average number of PCISPH iterations per step
+	double savedParticleUpdates; /// average number of particle force evaluations per step skipped by the local time stepping
+	double dispatches; /// average number of compute dispatches per step, 0 for the CPU implementations
+	double movedBytes; /// average estimated buffer traffic of the dispatches per step (own elements of the invocations, without the neighbour reads)
+	double l1dMisses; /// average L1 data cache read misses of this process per step, negative if the hardware counters are not available
+	double llcMisses; /// average last level cache misses of this process per step, negative if not available
+	double ioBytes; /// average particle data streamed through the memory per step by the out-of-core implementations
+	double ioWaitTime; /// average time per step waiting for the prefetched data [ms]
+	double storageReadBytes; /// average bytes per step this process read from the storage (/proc/self/io), negative if not available
+	double storageWriteBytes; /// average bytes per step this process caused to be written to the storage, negative if not available
+	double peakResidentBytes; /// peak resident set size of the process since its start
+};
+
+/// runs warmupStepN steps (not measured), then measures stepN steps
+BenchmarkResult runBenchmark(SPH& sph, unsigned warmupStepN, unsigned stepN);
+
+std::ostream& operator<<(std::ostream& s, const BenchmarkResult& r);
+
+struct Scene;
+/* Collision cost against the number of obstacles: for 0, 1, 2, 4, ... maxObstacleN obstacles (the scene's obstacles repeated,
+ * each copy shrunk into its own cell of the box) bakes the distance field and benchmarks stepN steps of the scene's backend.
+ * Needs the GL context.
+ * \return false on error
+ */
+bool runObstacleBenchmark(const Scene& scene, const SPHconfig& config, unsigned maxObstacleN, unsigned stepN);
+
+#endif /* BENCHMARK_HPP_26_10_19_09_41_27 */
@@ -1,7 +1,10 @@
 #include "bounds.hpp"
 
-Bounds::Bounds(vec3 _size): min{0,0,0}, max{_size} {
+Bounds::Bounds(vec3 _size): min{0,0,0}, max{_size}, vao{0}, vbo{0}, vboLineIndices{0} {
 	transform = scale(glm::identity<glm::mat4x4>(), _size);
+}
+
+void Bounds::initWireframe() {
 	glGenVertexArrays(1, &vao);
 	glBindVertexArray(vao);
 
@@ -43,6 +46,8 @@ Bounds::Bounds(vec3 _size): min{0,0,0}, max{_size} {
 }
 
 void Bounds::draw() {
+	if(!vao)
+		initWireframe();
 	glBindVertexArray(vao);
 	GLuint program;
 	glGetIntegerv(GL_CURRENT_PROGRAM, (GLint*)&program);
@@ -64,6 +69,8 @@ bool Bounds::isOutside(const vec3 &p, vec3 &n) {
 		n = {0,0,1};
 	else if(p.z > max.z)
 		n = {0,0,-1};
+	else if(obstacles && obstacles->distance(p) < 0)
+		n = obstacles->normal(p);
 	else
 		r = false;
 	return r;
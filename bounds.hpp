@@ -8,22 +8,30 @@
 //----------------------------------------------------------------------------------------
 #ifndef BOUNDS_HPP_20_01_07_21_15_07
 #define BOUNDS_HPP_20_01_07_21_15_07 
+#include <memory>
 #include "utils.hpp"
+#include "sdf.hpp"
 
-/// Box bounds for the particle simulation, wireframe drawing
+/// Box bounds for the particle simulation with optional static obstacles inside, wireframe drawing
+/// The wireframe is created by the first draw, the bounds alone do not need the GL context.
 class Bounds {
 	public:
 		Bounds(vec3 _size);
 
 		void draw();
+		/// \return true if p is outside the box or inside an obstacle, n is then the surface normal
 		bool isOutside(const vec3 &p, vec3 &n);
 
 		vec3 min;
 		vec3 max;
+		std::shared_ptr<const SignedDistanceField> obstacles; /// may be null
 		glm::mat4x4 transform;
 		GLuint vao;
 		GLuint vbo;
 		GLuint vboLineIndices;
+
+	private:
+		void initWireframe();
 };
 
 #endif /* BOUNDS_HPP_20_01_07_21_15_07 */
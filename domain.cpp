@@ -0,0 +1,419 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+#include "domain.hpp"
+#include "initialState.hpp"
+using namespace std;
+using namespace glm;
+
+template <typename T>
+static void append(vector<char>& message, const T* data, unsigned n) {
+	size_t offset = message.size();
+	message.resize(offset + n*sizeof(T));
+	memcpy(message.data()+offset, data, n*sizeof(T));
+}
+
+template <typename T>
+static const char* extract(const char* message, T* data, unsigned n) {
+	memcpy(data, message, n*sizeof(T));
+	return message + n*sizeof(T);
+}
+
+/// the initial particles of SPHcpu::reset, the same in every process
+template <typename F>
+static void generateInitialParticles(const SPHconfig& config, Bounds& b, F particle) {
+	InitialState state(config, b);
+	for(unsigned i = 0; i < config.particleN; ++i) {
+		vec3 pos, vel;
+		state.particle(i, pos, vel);
+		particle(pos, vel);
+	}
+}
+
+SPHdomain::SPHdomain(const SPHconfig& _config, Bounds& _b, Transport& _transport, const std::vector<float>& slabBoundaries):
+	ghostN{0}, migratedN{0}, computeTime{0}, exchangeTime{0}, config{_config}, b{_b}, transport{_transport}, owned{0}
+{
+	unsigned r = transport.rank();
+	slabMin = slabBoundaries[r];
+	slabMax = slabBoundaries[r+1];
+	neighbours[0] = r > 0 ? int(r)-1 : -1;
+	neighbours[1] = r+1 < transport.size() ? int(r)+1 : -1;
+	// cells of at least H, the slab extended by H on both sides holds all the ghosts
+	cellSize = config.H;
+	gridMin = vec3(slabMin - config.H, b.min.y, b.min.z);
+	vec3 extent = vec3(slabMax + config.H, b.max.y, b.max.z) - gridMin;
+	for(int a = 0; a < 3; ++a)
+		gridSize[a] = std::max(1u, unsigned(extent[a]/cellSize));
+	cellFirst.resize(gridSize[0]*gridSize[1]*gridSize[2] + 1);
+	reset();
+}
+
+std::vector<float> SPHdomain::balancedSlabs(const SPHconfig& config, Bounds& b, unsigned slabN, float minWidth) {
+	vector<float> x;
+	x.reserve(config.particleN);
+	generateInitialParticles(config, b, [&](const vec3& pos, const vec3&) { x.push_back(pos.x); });
+	sort(x.begin(), x.end());
+	vector<float> boundaries(slabN+1);
+	boundaries[0] = b.min.x;
+	boundaries[slabN] = b.max.x;
+	for(unsigned s = 1; s < slabN; ++s) {
+		float maxBoundary = b.max.x - (slabN-s)*minWidth;
+		boundaries[s] = std::min(std::max(x[size_t(s)*x.size()/slabN], boundaries[s-1] + minWidth), maxBoundary);
+		if(boundaries[s] - boundaries[s-1] < minWidth)
+			return {};
+	}
+	if(boundaries[slabN] - boundaries[slabN-1] < minWidth)
+		return {};
+	return boundaries;
+}
+
+void SPHdomain::reset() {
+	particlePos.clear();
+	particleVel.clear();
+	bool last = neighbours[1] < 0;
+	generateInitialParticles(config, b, [&](const vec3& pos, const vec3& vel) {
+		if(pos.x >= slabMin && (pos.x < slabMax || last)) {
+			particlePos.push_back(pos);
+			particleVel.push_back(vel);
+		}
+	});
+	owned = particlePos.size();
+	density.assign(owned, config.Rho0);
+}
+
+void SPHdomain::update() {
+	auto begin = chrono::steady_clock::now();
+	float waiting = 0;
+	auto timed = [&](void (SPHdomain::*f)()) {
+		auto begin = chrono::steady_clock::now();
+		(this->*f)();
+		waiting += chrono::duration<float, milli>(chrono::steady_clock::now() - begin).count();
+	};
+	timed(&SPHdomain::exchangeGhosts);
+	buildGrid();
+	computeDensities();
+	timed(&SPHdomain::exchangeGhostDensities);
+	integrate();
+	collide();
+	timed(&SPHdomain::migrate);
+	exchangeTime = waiting;
+	computeTime = chrono::duration<float, milli>(chrono::steady_clock::now() - begin).count() - waiting;
+}
+
+void SPHdomain::exchangeGhosts() {
+	particlePos.resize(owned);
+	particleVel.resize(owned);
+	sentGhosts[0].clear();
+	sentGhosts[1].clear();
+	for(unsigned i = 0; i < owned; ++i) {
+		if(particlePos[i].x < slabMin + config.H)
+			sentGhosts[0].push_back(i);
+		if(particlePos[i].x >= slabMax - config.H)
+			sentGhosts[1].push_back(i);
+	}
+	ghostN = 0;
+	for(int side = 0; side < 2; ++side) {
+		if(neighbours[side] < 0)
+			continue;
+		messageOut.clear();
+		for(unsigned i : sentGhosts[side]) {
+			append(messageOut, &particlePos[i], 1);
+			append(messageOut, &particleVel[i], 1);
+		}
+		transport.exchange(neighbours[side], messageOut, messageIn);
+		unsigned n = messageIn.size()/(2*sizeof(vec3));
+		const char* m = messageIn.data();
+		for(unsigned i = 0; i < n; ++i) {
+			vec3 pos, vel;
+			m = extract(m, &pos, 1);
+			m = extract(m, &vel, 1);
+			particlePos.push_back(pos);
+			particleVel.push_back(vel);
+		}
+		ghostN += n;
+	}
+	density.resize(particlePos.size());
+}
+
+void SPHdomain::exchangeGhostDensities() {
+	// the ghosts are ordered as they were received: the left neighbour first
+	unsigned ghost = owned;
+	for(int side = 0; side < 2; ++side) {
+		if(neighbours[side] < 0)
+			continue;
+		messageOut.clear();
+		for(unsigned i : sentGhosts[side])
+			append(messageOut, &density[i], 1);
+		transport.exchange(neighbours[side], messageOut, messageIn);
+		unsigned n = messageIn.size()/sizeof(float);
+		extract(messageIn.data(), &density[ghost], n);
+		ghost += n;
+	}
+}
+
+void SPHdomain::migrate() {
+	// the leaving particles are replaced by the last owned ones
+	leaving[0].clear();
+	leaving[1].clear();
+	for(unsigned i = 0; i < owned; ) {
+		int side = particlePos[i].x < slabMin ? 0 : (particlePos[i].x >= slabMax ? 1 : -1);
+		if(side < 0 || neighbours[side] < 0) {
+			++i;
+			continue;
+		}
+		leaving[side].push_back(particlePos[i]);
+		leaving[side].push_back(particleVel[i]);
+		--owned;
+		particlePos[i] = particlePos[owned];
+		particleVel[i] = particleVel[owned];
+	}
+	particlePos.resize(owned);
+	particleVel.resize(owned);
+	migratedN = (leaving[0].size() + leaving[1].size())/2;
+	for(int side = 0; side < 2; ++side) {
+		if(neighbours[side] < 0)
+			continue;
+		messageOut.clear();
+		append(messageOut, leaving[side].data(), leaving[side].size());
+		transport.exchange(neighbours[side], messageOut, messageIn);
+		unsigned n = messageIn.size()/(2*sizeof(vec3));
+		const char* m = messageIn.data();
+		for(unsigned i = 0; i < n; ++i) {
+			vec3 pos, vel;
+			m = extract(m, &pos, 1);
+			m = extract(m, &vel, 1);
+			particlePos.push_back(pos);
+			particleVel.push_back(vel);
+		}
+	}
+	owned = particlePos.size();
+	density.resize(owned);
+}
+
+unsigned SPHdomain::particleCell(const vec3& p) const {
+	unsigned c[3];
+	// an unstable run may throw the particles out of the grid (or make them NaN), they must stay in it
+	for(int a = 0; a < 3; ++a) {
+		float x = (p[a] - gridMin[a])/cellSize;
+		c[a] = x >= 0 ? unsigned(std::min(x, float(gridSize[a]-1))) : 0;
+	}
+	return (c[0]*gridSize[1] + c[1])*gridSize[2] + c[2];
+}
+
+void SPHdomain::buildGrid() {
+	fill(cellFirst.begin(), cellFirst.end(), 0);
+	for(const vec3& p : particlePos)
+		++cellFirst[particleCell(p)+1];
+	for(unsigned c = 1; c < cellFirst.size(); ++c)
+		cellFirst[c] += cellFirst[c-1];
+	cellParticles.resize(particlePos.size());
+	cellNext.assign(cellFirst.begin(), cellFirst.end()-1);
+	for(unsigned i = 0; i < particlePos.size(); ++i)
+		cellParticles[cellNext[particleCell(particlePos[i])]++] = i;
+}
+
+/// calls f(j) for every particle j in the 27 cells around the cell of p
+template <typename F>
+static void forNeighbours(const vec3& p, const vec3& gridMin, float cellSize, const unsigned (&gridSize)[3],
+		const vector<unsigned>& cellFirst, const vector<unsigned>& cellParticles, F f) {
+	int c[3];
+	for(int a = 0; a < 3; ++a) {
+		float x = (p[a] - gridMin[a])/cellSize;
+		c[a] = x >= 0 ? int(std::min(x, float(gridSize[a]-1))) : 0;
+	}
+	for(int x = std::max(0, c[0]-1); x <= std::min(int(gridSize[0])-1, c[0]+1); ++x)
+		for(int y = std::max(0, c[1]-1); y <= std::min(int(gridSize[1])-1, c[1]+1); ++y)
+			for(int z = std::max(0, c[2]-1); z <= std::min(int(gridSize[2])-1, c[2]+1); ++z) {
+				unsigned cell = (x*gridSize[1] + y)*gridSize[2] + z;
+				for(unsigned k = cellFirst[cell]; k < cellFirst[cell+1]; ++k)
+					f(cellParticles[k]);
+			}
+}
+
+void SPHdomain::computeDensities() {
+	for(unsigned i = 0; i < owned; ++i) {
+		density[i] = config.M;
+		forNeighbours(particlePos[i], gridMin, cellSize, gridSize, cellFirst, cellParticles, [&](unsigned j) {
+			addWcsphDensity(config, particlePos[i]-particlePos[j], density[i]);
+		});
+	}
+}
+
+void SPHdomain::integrate() {
+	// the velocities change in place, the forces need the old ones of the neighbours
+	if(acceleration.size() < owned)
+		acceleration.resize(owned);
+	for(unsigned i = 0; i < owned; ++i) {
+		float pressureI = wcsphPressure(config, density[i]);
+		vec3 fPressure = {};
+		vec3 fViscosity = {};
+		forNeighbours(particlePos[i], gridMin, cellSize, gridSize, cellFirst, cellParticles, [&](unsigned j) {
+			addWcsphForces(config, particlePos[i]-particlePos[j], pressureI, wcsphPressure(config, density[j]), density[j],
+				particleVel[i], particleVel[j], fPressure, fViscosity);
+		});
+		acceleration[i] = wcsphAcceleration(fPressure, fViscosity, density[i]);
+	}
+	for(unsigned i = 0; i < owned; ++i) {
+		particlePos[i] += particleVel[i]*config.Step;
+		particleVel[i] += acceleration[i]*config.Step;
+	}
+}
+
+void SPHdomain::collide() {
+	// the same as SPHcpu::collide
+	for(unsigned i = 0; i < owned; ++i) {
+		vec3 surfaceNormal;
+		float velL = length(particleVel[i]);
+		if(b.isOutside(particlePos[i], surfaceNormal) && velL > 0 && !isinf(velL)) {
+			particlePos[i] += -particleVel[i]*config.Step;
+			vec3 d = -particleVel[i]/velL;
+			particleVel[i] = (2*dot(d, surfaceNormal)*surfaceNormal-d)*velL;
+		}
+	}
+}
+
+void SPHdomain::getParticles(std::vector<vec3>& pos, std::vector<vec3>& vel) const {
+	pos.assign(particlePos.begin(), particlePos.begin()+owned);
+	vel.assign(particleVel.begin(), particleVel.begin()+owned);
+}
+
+void SPHdomain::getDensities(std::vector<float>& density) const {
+	density.assign(this->density.begin(), this->density.begin()+owned);
+}
+
+std::ostream& operator<<(std::ostream& s, const DecompositionResult& r) {
+	return s << "domains: " << r.domainN << "\n"
+		<< "particles: " << r.particleN << "\n"
+		<< "steps: " << r.stepN << "\n"
+		<< "avg step time: " << r.stepTime << " [ms]\n"
+		<< "avg compute time (slowest domain): " << r.computeTime << " [ms]\n"
+		<< "avg exchange time (slowest domain): " << r.exchangeTime << " [ms]\n"
+		<< "ghosts per step: " << r.ghostsPerStep << "\n"
+		<< "migrated particles per step: " << r.migratedPerStep << "\n"
+		<< "particles per domain: " << r.minOwnedN << " - " << r.maxOwnedN << "\n"
+		<< (r.nan ? "unstable\n" : "");
+}
+
+/// sent by every rank to the rank 0 at the end of the run
+struct DomainStatistics {
+	double computeTime;
+	double exchangeTime;
+	unsigned long long ghostN;
+	unsigned long long migratedN;
+	unsigned ownedN;
+	bool nan;
+};
+
+bool runDecomposed(const Scene& scene, unsigned domainN, DecompositionResult& r) {
+	if(!scene.obstacles.empty())
+		cerr << "Obstacles are not supported by the decomposed run, ignored\n";
+	SPHconfig config(scene.particleN, scene.subdivisionN);
+	scene.apply(config);
+	if(config.Solver != PressureSolver::WCSPH || config.LocalTimeStepping)
+		cerr << "The decomposed run supports only the WCSPH solver with global steps, used instead\n";
+	Bounds b(scene.boxSize);
+	vector<float> slabs = SPHdomain::balancedSlabs(config, b, domainN, config.H);
+	if(slabs.empty()) {
+		cerr << "The box cannot be split to " << domainN << " slabs at least h wide\n";
+		return false;
+	}
+	cout.flush();
+	cerr.flush();
+	unique_ptr<LocalTransport> transport = LocalTransport::spawn(domainN);
+	if(!transport) {
+		cerr << "Cannot create the processes of the domains\n";
+		return false;
+	}
+	SPHdomain domain(config, b, *transport, slabs);
+	DomainStatistics stats{0, 0, 0, 0, 0, false};
+	auto begin = chrono::steady_clock::now();
+	for(unsigned i = 0; i < scene.stepN; ++i) {
+		domain.update();
+		stats.computeTime += domain.computeTime;
+		stats.exchangeTime += domain.exchangeTime;
+		stats.ghostN += domain.ghostN;
+		stats.migratedN += domain.migratedN;
+	}
+	double wallTime = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+	vector<vec3> pos, vel;
+	vector<float> density;
+	domain.getParticles(pos, vel);
+	domain.getDensities(density);
+	for(unsigned p = 0; p < pos.size(); ++p)
+		if(!isfinite(density[p]) || !isfinite(pos[p].x+pos[p].y+pos[p].z) || !isfinite(vel[p].x+vel[p].y+vel[p].z))
+			stats.nan = true;
+	stats.ownedN = domain.ownedN();
+
+	vector<char> message;
+	if(transport->rank() != 0) {
+		append(message, &stats, 1);
+		transport->send(0, message);
+		transport.reset();
+		_exit(0);
+	}
+	r = {domainN, 0, scene.stepN, wallTime/scene.stepN, 0, 0, 0, 0, stats.ownedN, stats.ownedN, false};
+	for(unsigned rank = 0; rank < domainN; ++rank) {
+		if(rank != 0) {
+			transport->receive(rank, message);
+			extract(message.data(), &stats, 1);
+		}
+		r.particleN += stats.ownedN;
+		r.computeTime = std::max(r.computeTime, stats.computeTime/scene.stepN);
+		r.exchangeTime = std::max(r.exchangeTime, stats.exchangeTime/scene.stepN);
+		r.ghostsPerStep += double(stats.ghostN)/scene.stepN;
+		r.migratedPerStep += double(stats.migratedN)/scene.stepN;
+		r.minOwnedN = std::min(r.minOwnedN, stats.ownedN);
+		r.maxOwnedN = std::max(r.maxOwnedN, stats.ownedN);
+		r.nan = r.nan || stats.nan;
+	}
+	return transport->wait();
+}
+
+bool runScalingBenchmark(const Scene& scene, unsigned maxDomainN) {
+	ostringstream table;
+	table << "scaling,domains,particles,step_time_ms,compute_time_ms,exchange_time_ms,ghosts_per_step,migrated_per_step,speedup,efficiency\n";
+	bool allOk = true;
+	for(int weak = 0; weak < 2; ++weak) {
+		double baseTime = 0;
+		for(unsigned domainN = 1; domainN <= maxDomainN; domainN *= 2) {
+			Scene s = scene;
+			if(weak) {
+				// the same work per domain - the box and the fluid grow along x
+				s.particleN *= domainN;
+				s.boxSize.x *= domainN;
+				for(FluidBlock& fb : s.fluidBlocks) {
+					fb.min.x *= domainN;
+					fb.max.x *= domainN;
+				}
+			}
+			DecompositionResult r;
+			if(!runDecomposed(s, domainN, r)) {
+				allOk = false;
+				break;
+			}
+			allOk = allOk && !r.nan;
+			if(domainN == 1)
+				baseTime = r.stepTime;
+			// strong: T1/Tn, ideally n; weak: T1/Tn, ideally 1
+			double speedup = baseTime/r.stepTime;
+			double efficiency = weak ? speedup : speedup/domainN;
+			table << (weak ? "weak" : "strong") << "," << domainN << "," << r.particleN << "," << r.stepTime << ","
+				<< r.computeTime << "," << r.exchangeTime << "," << r.ghostsPerStep << "," << r.migratedPerStep << ","
+				<< speedup << "," << efficiency << "\n";
+		}
+	}
+	cout << table.str();
+	if(!scene.output.empty()) {
+		ofstream f(scene.output);
+		f << table.str();
+		if(!f) {
+			cerr << "Could not write " << scene.output << endl;
+			return false;
+		}
+	}
+	return allOk;
+}
@@ -0,0 +1,118 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       domain.hpp
+ * \author     Ales Koblizek
+ * \date       2026/10/19
+ * \brief      Spatial domain decomposition of the CPU simulation across processes
+*/
+//----------------------------------------------------------------------------------------
+#ifndef DOMAIN_HPP_26_10_19_13_12_47
+#define DOMAIN_HPP_26_10_19_13_12_47
+#include "sph.hpp"
+#include "scene.hpp"
+#include "transport.hpp"
+
+/* WCSPH on the particles of one slab of the bounds along x, the rank r of the transport owns the slab r.
+ * Every step the neighbouring slabs exchange the ghost particles within H of their common boundary
+ * (positions and velocities before the densities, then the densities of the same particles before the forces)
+ * and after the integration the particles which left the slab migrate to the neighbour.
+ * The slabs must be at least H wide, so the ghosts come only from the two neighbours.
+ * Needs no GL context, the WCSPH terms are shared with SPHcpu (sph.hpp).
+ */
+class SPHdomain {
+	public:
+		/// \param slabBoundaries x coordinates of the boundaries of transport.size() slabs (transport.size()+1 values from b.min.x to b.max.x)
+		SPHdomain(const SPHconfig& config, Bounds& b, Transport& transport, const std::vector<float>& slabBoundaries);
+
+		/// the same initial particles as SPHcpu::reset, this domain keeps those inside its slab
+		void reset();
+		void update();
+
+		unsigned ownedN() const { return owned; }
+		/// particles of this slab, the ghosts excluded
+		void getParticles(std::vector<vec3>& pos, std::vector<vec3>& vel) const;
+		void getDensities(std::vector<float>& density) const;
+
+		/* Slab boundaries with about the same number of the initial particles in every slab,
+		 * each slab at least minWidth wide.
+		 * \return empty if the bounds cannot be split to slabN slabs of minWidth
+		 */
+		static std::vector<float> balancedSlabs(const SPHconfig& config, Bounds& b, unsigned slabN, float minWidth);
+
+		unsigned ghostN; /// ghosts received in the last step
+		unsigned migratedN; /// particles which left this slab in the last step
+		float computeTime; /// the last step without the waiting for the neighbours [ms]
+		float exchangeTime; /// the last step: the ghost exchange and the migration [ms]
+
+	private:
+		/// sends the owned particles within H of the boundary to both neighbours, appends the received ghosts
+		void exchangeGhosts();
+		/// sends the densities of the particles sent by exchangeGhosts
+		void exchangeGhostDensities();
+		/// sends the particles outside the slab to the neighbour, appends the received ones
+		void migrate();
+		/// counting sort of the owned particles and the ghosts into the cells of the slab extended by H
+		void buildGrid();
+		unsigned particleCell(const vec3& p) const;
+		void computeDensities();
+		void integrate();
+		void collide();
+
+		const SPHconfig& config;
+		Bounds& b;
+		Transport& transport;
+		float slabMin;
+		float slabMax;
+		int neighbours[2]; /// left and right rank, -1 at the sides of the bounds
+
+		std::vector<vec3> particlePos; /// the owned particles, then the ghosts
+		std::vector<vec3> particleVel;
+		std::vector<float> density;
+		unsigned owned;
+		std::vector<unsigned> sentGhosts[2]; /// indices of the owned particles sent to the left and to the right neighbour
+
+		vec3 gridMin;
+		float cellSize;
+		unsigned gridSize[3];
+		std::vector<unsigned> cellFirst; /// per cell, the last entry is the total
+		std::vector<unsigned> cellParticles; /// particle indices sorted by the cell
+		std::vector<unsigned> cellNext; /// buildGrid: the next free position of each cell in cellParticles
+
+		// the step reuses these, so that it does not allocate once they have grown
+		std::vector<vec3> acceleration; /// integrate: the owned particles
+		std::vector<vec3> leaving[2]; /// migrate: positions and velocities leaving to the left and to the right
+
+		std::vector<char> messageOut;
+		std::vector<char> messageIn;
+};
+
+/// Statistics of a decomposed run, collected by the rank 0
+struct DecompositionResult {
+	unsigned domainN;
+	unsigned particleN;
+	unsigned stepN;
+	double stepTime; /// wall time per step [ms]
+	double computeTime; /// per step, the slowest domain [ms]
+	double exchangeTime; /// per step, the slowest domain [ms]
+	double ghostsPerStep; /// all the domains together
+	double migratedPerStep; /// all the domains together
+	unsigned minOwnedN; /// at the end, the load balance
+	unsigned maxOwnedN;
+	bool nan; /// NaN or inf found in the particle state at the end
+};
+
+std::ostream& operator<<(std::ostream& s, const DecompositionResult& r);
+
+/* Runs scene.stepN steps with the bounds split to domainN slabs, each in a process forked by LocalTransport
+ * (call before the GL context is created).
+ * \return false if the processes cannot be created, failed or the scene cannot be split
+ */
+bool runDecomposed(const Scene& scene, unsigned domainN, DecompositionResult& r);
+
+/* Strong scaling (the scene as it is) and weak scaling (the particles, the box and the fluid blocks
+ * stretched along x by the number of the domains) for 1, 2, 4... maxDomainN domains.
+ * Writes the table to scene.output (CSV) if set and to stdout.
+ */
+bool runScalingBenchmark(const Scene& scene, unsigned maxDomainN);
+
+#endif /* DOMAIN_HPP_26_10_19_13_12_47 */
@@ -0,0 +1,129 @@
+#include <cstring>
+#include <GL/glew.h>
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <GL/freeglut.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include "glContext.hpp"
+#include "utils.hpp"
+using namespace std;
+
+bool createWindowContext(int& argc, char* argv[], unsigned winSize, const char* title) {
+	glutInit(&argc, argv);
+#ifdef DEBUG
+	glutInitContextFlags (GLUT_CORE_PROFILE | GLUT_DEBUG);
+#else
+	glutInitContextFlags (GLUT_CORE_PROFILE);
+#endif
+	glutInitWindowSize(winSize, winSize);
+	glutInitDisplayMode( GLUT_DOUBLE | GLUT_RGBA );
+	return glutCreateWindow(title) > 0;
+}
+
+static bool hasExtension(const char* extensions, const char* name) {
+	if(!extensions)
+		return false;
+	size_t n = strlen(name);
+	for(const char* e = strstr(extensions, name); e; e = strstr(e+n, name))
+		if((e == extensions || e[-1] == ' ') && (e[n] == ' ' || e[n] == '\0'))
+			return true;
+	return false;
+}
+
+bool createHeadlessContext() {
+	// the surfaceless platform needs no X11/Wayland/DRM device at all
+	EGLDisplay display = EGL_NO_DISPLAY;
+	const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if(getPlatformDisplay && hasExtension(clientExtensions, "EGL_MESA_platform_surfaceless"))
+		display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+	if(display == EGL_NO_DISPLAY)
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	EGLint major, minor;
+	if(display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+		cerr << "Cannot initialize the EGL display\n";
+		return false;
+	}
+	if(!eglBindAPI(EGL_OPENGL_API)) {
+		cerr << "EGL does not support OpenGL\n";
+		return false;
+	}
+	const char* extensions = eglQueryString(display, EGL_EXTENSIONS);
+	bool surfaceless = hasExtension(extensions, "EGL_KHR_surfaceless_context");
+
+	EGLint configAttribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+	EGLConfig config = nullptr;
+	EGLint configN = 0;
+	if(!eglChooseConfig(display, configAttribs, &config, 1, &configN) || configN == 0) {
+		// the surfaceless context does not need a config
+		if(!surfaceless || !hasExtension(extensions, "EGL_KHR_no_config_context")) {
+			cerr << "No EGL config for OpenGL\n";
+			return false;
+		}
+		config = EGL_NO_CONFIG_KHR;
+	}
+
+	EGLint contextAttribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 4,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+#ifdef DEBUG
+		EGL_CONTEXT_OPENGL_DEBUG, EGL_TRUE,
+#endif
+		EGL_NONE
+	};
+	EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+	if(context == EGL_NO_CONTEXT) {
+		cerr << "Cannot create the OpenGL 4.3 core context (EGL error 0x" << hex << eglGetError() << dec << ")\n";
+		return false;
+	}
+	EGLSurface surface = EGL_NO_SURFACE;
+	if(!surfaceless) {
+		EGLint pbufferAttribs[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+		surface = eglCreatePbufferSurface(display, config, pbufferAttribs);
+		if(surface == EGL_NO_SURFACE) {
+			cerr << "Cannot create the EGL pbuffer\n";
+			return false;
+		}
+	}
+	if(!eglMakeCurrent(display, surface, surface, context)) {
+		cerr << "Cannot make the EGL context current\n";
+		return false;
+	}
+	cout << "Headless EGL " << major << "." << minor << " context (" << (surfaceless ? "surfaceless" : "pbuffer") << ")\n";
+	return true;
+}
+
+bool initGlFunctions() {
+	GLenum e = glewInit();
+	// GLEW built for GLX looks for the GLX display, the functions of the EGL context are loaded anyway
+	if(e == GLEW_ERROR_NO_GLX_DISPLAY)
+		e = glewContextInit();
+	if(e != GLEW_OK) {
+		cerr << "Cannot initialize GLEW: " << glewGetErrorString(e) << endl;
+		return false;
+	}
+	cout << "OpenGL renderer: " << glGetString(GL_RENDERER) << endl;
+#ifdef DEBUG
+	if(glDebugMessageCallback){
+		cout << "Register OpenGL debug callback " << endl;
+		glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+		glDebugMessageCallback(GLDEBUGPROC(openglCallbackFunction), nullptr);
+		GLuint unusedIds = 0;
+		glDebugMessageControl(GL_DONT_CARE,
+				GL_DONT_CARE,
+				GL_DONT_CARE,
+				0,
+				&unusedIds,
+				true);
+	}
+	else
+		cout << "glDebugMessageCallback not available" << endl;
+#endif
+	return true;
+}
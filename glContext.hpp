@@ -0,0 +1,25 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       glContext.hpp
+ * \author     Ales Koblizek
+ * \date       2026/10/19
+ * \brief      Creation of the OpenGL context - GLUT window or headless EGL
+*/
+//----------------------------------------------------------------------------------------
+#ifndef GLCONTEXT_HPP_26_10_19_14_35_58
+#define GLCONTEXT_HPP_26_10_19_14_35_58
+
+/// creates the GLUT window with the OpenGL 4.3 core context (debug context in the DEBUG build)
+bool createWindowContext(int& argc, char* argv[], unsigned winSize, const char* title);
+
+/* OpenGL 4.3 core context without any window system (EGL): the Mesa surfaceless platform if available,
+ * otherwise the default display. The context is made current without a surface (EGL_KHR_surfaceless_context)
+ * or with a 1x1 pbuffer. Works with the software drivers such as Mesa llvmpipe.
+ * Nothing can be drawn to the screen, the compute shaders and the offscreen rendering work.
+ */
+bool createHeadlessContext();
+
+/// loads the OpenGL functions (GLEW) for the current context and registers the debug callback in the DEBUG build
+bool initGlFunctions();
+
+#endif /* GLCONTEXT_HPP_26_10_19_14_35_58 */
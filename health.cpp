@@ -0,0 +1,23 @@
+#include "health.hpp"
+using namespace std;
+
+HealthLog::HealthLog(const std::string& file, unsigned _period): f{file}, period{_period ? _period : 1} {
+	f << "step,step_time_ms";
+	for(unsigned b = 0; b < HealthMetrics::OccupancyBinN; ++b) {
+		if(b <= 1)
+			f << ",cells_" << b;
+		else if(b+1 < HealthMetrics::OccupancyBinN)
+			f << ",cells_" << (1u << (b-1)) << "_" << (1u << b)-1;
+		else
+			f << ",cells_" << (1u << (b-1)) << "_";
+	}
+	f << ",max_occupancy,candidates,in_range,in_range_ratio,mean_density_error,rms_density_error,max_density_error,min_density,max_density\n";
+}
+
+void HealthLog::record(unsigned step, float stepTime, const HealthMetrics& m) {
+	f << step << "," << stepTime;
+	for(unsigned b = 0; b < HealthMetrics::OccupancyBinN; ++b)
+		f << "," << m.occupancy[b];
+	f << "," << m.maxOccupancy << "," << m.candidates << "," << m.inRange << "," << (m.candidates ? double(m.inRange)/m.candidates : 0)
+		<< "," << m.meanDensityError << "," << m.rmsDensityError << "," << m.maxDensityError << "," << m.minDensity << "," << m.maxDensity << "\n";
+}
@@ -0,0 +1,58 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       health.hpp
+ * \author     Ales Koblizek
+ * \date       2026/10/19
+ * \brief      Per-step statistics of the neighbour-search grid and of the density, time series log
+*/
+//----------------------------------------------------------------------------------------
+#ifndef HEALTH_HPP_26_10_19_14_10_33
+#define HEALTH_HPP_26_10_19_14_10_33
+#include <fstream>
+#include <string>
+
+/* Statistics of the grid and of the density at the start of a step (after the density pass).
+ * Many particles per cell or a low inRange/candidates ratio mean too coarse grid for H,
+ * mostly empty cells too fine grid; the density error grows with too long Step or too soft K.
+ */
+struct HealthMetrics {
+	static const unsigned OccupancyBinN = 12;
+	/// cells with 0, 1, 2-3, 4-7... particles - the bin b >= 1 counts [2^(b-1), 2^b), the last bin takes the rest
+	unsigned occupancy[OccupancyBinN];
+	unsigned maxOccupancy; /// most particles in a cell
+	unsigned long long candidates; /// particle pairs visited in the 27 neighbour cells
+	unsigned long long inRange; /// the visited pairs closer than H
+	float meanDensityError; /// mean |density-Rho0|/Rho0
+	float rmsDensityError;
+	float maxDensityError;
+	float minDensity;
+	float maxDensity;
+};
+
+/// occupancy bin of a cell with n particles
+inline unsigned occupancyBin(unsigned n) {
+	unsigned b = 0;
+	while(n) {
+		++b;
+		n >>= 1;
+	}
+	return b < HealthMetrics::OccupancyBinN ? b : HealthMetrics::OccupancyBinN-1;
+}
+
+/// CSV time series of the metrics, one line per recorded step next to its time
+class HealthLog {
+	public:
+		/// \param period every period-th step is recorded
+		HealthLog(const std::string& file, unsigned period = 1);
+		bool valid() const { return bool(f); }
+		/// \return true if the step (counted from 0) should be collected
+		bool due(unsigned step) const { return step % period == 0; }
+		/// \param stepTime [ms]
+		void record(unsigned step, float stepTime, const HealthMetrics& m);
+
+	private:
+		std::ofstream f;
+		unsigned period;
+};
+
+#endif /* HEALTH_HPP_26_10_19_14_10_33 */
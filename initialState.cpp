@@ -0,0 +1,173 @@
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include "initialState.hpp"
+using namespace std;
+using namespace glm;
+
+/// integer hash with a good avalanche (lowbias32), exact in GLSL as well
+static unsigned hashUint(unsigned x) {
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+float counterRandom(unsigned seed, unsigned particle, unsigned draw) {
+	// 24 bits, the float is exact
+	return float(hashUint(hashUint(hashUint(seed) ^ particle) ^ draw) >> 8)/16777216.f;
+}
+
+InitialState::InitialState(const SPHconfig& _config, const Bounds& _b): config{_config}, b{_b} {
+	vector<FluidBlock> fluid = config.fluidBlocks;
+	if(fluid.empty())
+		fluid.push_back({b.min, b.max});
+	double volume = 0;
+	for(const FluidBlock& fb : fluid) {
+		vec3 s = fb.max-fb.min;
+		volume += double(s.x)*s.y*s.z;
+	}
+	double preceding = 0;
+	for(const FluidBlock& fb : fluid) {
+		vec3 s = fb.max-fb.min;
+		InitialBlock ib{};
+		ib.firstParticle = unsigned(config.particleN*preceding/volume);
+		preceding += double(s.x)*s.y*s.z;
+		ib.min = vec4(fb.min, 0);
+		ib.max = vec4(fb.max, float(preceding/volume));
+		initialBlocks.push_back(ib);
+	}
+	initialBlocks.back().max.w = 1;
+	if(config.Layout != InitialLayout::Lattice)
+		return;
+	if(b.obstacles)
+		freeNodes.resize(config.particleN);
+	for(unsigned k = 0; k < initialBlocks.size(); ++k) {
+		unsigned n = (k+1 < initialBlocks.size() ? initialBlocks[k+1].firstParticle : config.particleN) - initialBlocks[k].firstParticle;
+		sizeLattice(k, fluid[k].max-fluid[k].min, n);
+	}
+}
+
+/// calls f(t, begin, end) for the contiguous parts of [0, count) on all the hardware threads (t - part index)
+template <typename F>
+static void parallelParts(unsigned long long count, unsigned threadN, F f) {
+	std::vector<std::thread> threads;
+	for(unsigned t = 1; t < threadN; ++t)
+		threads.emplace_back(f, t, count*t/threadN, count*(t+1)/threadN);
+	f(0, 0, count/threadN);
+	for(std::thread& t : threads)
+		t.join();
+}
+
+void InitialState::sizeLattice(unsigned k, const vec3& s, unsigned n) {
+	InitialBlock& ib = initialBlocks[k];
+	// the node indices are 32-bit (latticeNodes(), the GPU) and a block mostly inside the obstacles
+	// is not worth the memory of a much finer lattice, neither is built
+	const unsigned long long maxNodeN = std::min<unsigned long long>(numeric_limits<unsigned>::max(), 64ull*std::max(n, 1u));
+	// the volume per particle; if the obstacles take a part of the block, the free nodes measure the free volume
+	// and the spacing of the free volume per particle follows in one step, only the rounding of the lattice
+	// to whole nodes (and the nodes the obstacles newly cover) may take a few more
+	double spacing = cbrt(double(s.x)*s.y*s.z/std::max(n, 1u));
+	unsigned ny = 0;
+	unsigned long long freeN = 0;
+	for(bool first = true; ; first = false) {
+		unsigned nx = std::max(1u, unsigned(std::min(s.x/spacing, 1e9)));
+		unsigned nz = std::max(1u, unsigned(std::min(s.z/spacing, 1e9)));
+		unsigned nyNew = std::max(1u, unsigned(std::min(s.y/spacing, 1e9)));
+		unsigned long long nodeN = (unsigned long long)nx*nyNew*nz;
+		if(!first && nodeN > maxNodeN)
+			break;
+		ib.min.w = spacing;
+		ib.nx = nx;
+		ib.nz = nz;
+		ny = nyNew;
+		freeN = b.obstacles ? listFreeNodes(ib, ny, n) : nodeN;
+		if(freeN >= n)
+			break;
+		spacing *= std::min(0.99, cbrt(double(std::max(freeN, 1ull))/n));
+	}
+	if(freeN < n) {
+		cerr << "Fluid block " << k << " is almost entirely inside the obstacles, filling it regardless" << endl;
+		listFreeNodes(ib, ny, n, true);
+	}
+	// the spacing follows from the block volume, not from the rest density of the fluid
+	static atomic<bool> warned{false};
+	double density = config.M/pow(double(ib.min.w), 3);
+	if(std::abs(density/config.Rho0 - 1) > 0.1 && !warned.exchange(true))
+		cerr << "The lattice of the fluid block " << k << " starts at the density " << density << " (m/spacing^3), the rest density is "
+			<< config.Rho0 << endl;
+}
+
+unsigned long long InitialState::listFreeNodes(const InitialBlock& ib, unsigned ny, unsigned n, bool fillInside) {
+	// the jitter moves the particle at most this far from its node
+	const float reach = 0.5f*sqrt(3.f)*config.LatticeJitter*ib.min.w;
+	const unsigned long long nodeN = (unsigned long long)ib.nx*ny*ib.nz;
+	const unsigned threadN = std::max(1u, std::thread::hardware_concurrency());
+	// the free nodes of each part, then their positions in the list by the prefix sum
+	vector<unsigned char> free(nodeN);
+	vector<unsigned long long> partFirst(threadN+1, 0);
+	parallelParts(nodeN, threadN, [&](unsigned t, unsigned long long begin, unsigned long long end) {
+		unsigned long long freeN = 0;
+		for(unsigned long long j = begin; j < end; ++j) {
+			free[j] = b.obstacles->distance(latticeNode(ib, j)) >= reach;
+			freeN += free[j];
+		}
+		partFirst[t+1] = freeN;
+	});
+	for(unsigned t = 0; t < threadN; ++t)
+		partFirst[t+1] += partFirst[t];
+	parallelParts(nodeN, threadN, [&](unsigned t, unsigned long long begin, unsigned long long end) {
+		unsigned long long next = partFirst[t];
+		for(unsigned long long j = begin; j < end && next < n; ++j)
+			if(free[j])
+				freeNodes[ib.firstParticle + next++] = unsigned(j);
+	});
+	unsigned long long freeN = partFirst[threadN];
+	// the rest of the particles into the first nodes inside the obstacles
+	for(unsigned long long j = 0; fillInside && j < nodeN && freeN < n; ++j)
+		if(!free[j])
+			freeNodes[ib.firstParticle + freeN++] = unsigned(j);
+	return freeN;
+}
+
+vec3 InitialState::latticeNode(const InitialBlock& ib, unsigned long long j) {
+	vec3 node(j%ib.nx, j/(ib.nx*ib.nz), j/ib.nx%ib.nz);
+	return vec3(ib.min) + (node + 0.5f)*ib.min.w;
+}
+
+vec3 InitialState::randomPosition(unsigned i, unsigned& draw) const {
+	float v = counterRandom(config.Seed, i, draw++);
+	const InitialBlock* ib = &initialBlocks.back();
+	for(const InitialBlock& block : initialBlocks)
+		if(v < block.max.w) {
+			ib = &block;
+			break;
+		}
+	vec3 r(counterRandom(config.Seed, i, draw), counterRandom(config.Seed, i, draw+1), counterRandom(config.Seed, i, draw+2));
+	draw += 3;
+	return vec3(ib->min) + (vec3(ib->max)-vec3(ib->min))*r;
+}
+
+void InitialState::particle(unsigned i, vec3& pos, vec3& vel) const {
+	if(config.Layout == InitialLayout::Lattice) {
+		unsigned k = initialBlocks.size()-1;
+		while(k > 0 && initialBlocks[k].firstParticle > i)
+			--k;
+		const InitialBlock& ib = initialBlocks[k];
+		unsigned j = freeNodes.empty() ? i - ib.firstParticle : freeNodes[i];
+		vec3 jitter = vec3(counterRandom(config.Seed, i, 0), counterRandom(config.Seed, i, 1), counterRandom(config.Seed, i, 2)) - 0.5f;
+		pos = latticeNode(ib, j) + jitter*config.LatticeJitter*ib.min.w;
+		vel = vec3(0);
+		return;
+	}
+	unsigned draw = 0;
+	pos = randomPosition(i, draw);
+	// rejection sampling of the space occupied by the obstacles, the attempts are limited in case the fluid is fully covered
+	const unsigned attemptN = 64;
+	for(unsigned a = 1; a < attemptN && b.obstacles && b.obstacles->distance(pos) < 0; ++a)
+		pos = randomPosition(i, draw);
+	vel = normalize(vec3(counterRandom(config.Seed, i, draw), counterRandom(config.Seed, i, draw+1), counterRandom(config.Seed, i, draw+2)));
+}
@@ -0,0 +1,85 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       initialState.hpp
+ * \author     Ales Koblizek
+ * \date       2026/10/19
+ * \brief      Initial particles generated independently of each other (in parallel, the same on all the backends)
+*/
+//----------------------------------------------------------------------------------------
+#ifndef INITIALSTATE_HPP_26_10_19_19_12_05
+#define INITIALSTATE_HPP_26_10_19_19_12_05
+#include <algorithm>
+#include <thread>
+#include "sph.hpp"
+
+/// counter-based random number in [0, 1), the same as counterRandom of shaders/Init.comp
+float counterRandom(unsigned seed, unsigned particle, unsigned draw);
+
+/// Fluid block of the initial state, laid out as the InitialBlocks buffer of shaders/Init.comp (std430)
+struct InitialBlock {
+	vec4 min; /// w - lattice spacing
+	vec4 max; /// w - fraction of the fluid volume in this and the preceding blocks
+	unsigned firstParticle; /// the particles [firstParticle, next block's firstParticle) fill the block
+	unsigned nx; /// lattice nodes along x and z, the layers of nx*nz nodes are filled from the bottom
+	unsigned nz;
+	unsigned pad;
+};
+
+/* Initial particles of config.fluidBlocks (the whole bounds if there are none).
+ * Each block gets the share of the particles of its volume. The particle i depends only on (config.Seed, i):
+ *   InitialLayout::Random - uniformly random position (outside the obstacles if possible), random unit velocity
+ *   InitialLayout::Lattice - the node i of a cubic lattice of the block jittered by config.LatticeJitter, at rest;
+ *     the spacing is the largest one with enough nodes in the block, the top layer may be partial.
+ *     It follows from the block volume per particle, not from config.M/config.Rho0, a warning tells when that makes
+ *     the initial density differ from the rest density by more than 10 %.
+ *     The nodes the jitter could move into an obstacle are skipped (the collision handling would keep a particle
+ *     placed inside trapped there), the free nodes are listed by latticeNodes() then. The lattice has at most 2^32 nodes.
+ */
+class InitialState {
+	public:
+		InitialState(const SPHconfig& config, const Bounds& b);
+		void particle(unsigned i, vec3& pos, vec3& vel) const;
+		/// calls set(i, pos, vel) for all the particles on all the hardware threads
+		template <typename F>
+		void generate(F set) const;
+		const std::vector<InitialBlock>& blocks() const { return initialBlocks; }
+		/// lattice node (index within its block) of each particle, empty if all the nodes are used in order
+		const std::vector<unsigned>& latticeNodes() const { return freeNodes; }
+
+	private:
+		vec3 randomPosition(unsigned i, unsigned& draw) const;
+		/// lattice spacing and size of the block k (size s) for its n particles
+		void sizeLattice(unsigned k, const vec3& s, unsigned n);
+		/// tests the nodes of the lattice of the block in parallel, lists the first n free ones in freeNodes (from ib.firstParticle)
+		/// \param fillInside list the nodes inside the obstacles after the free ones if there are not enough
+		/// \return number of the free nodes (can be more than n)
+		unsigned long long listFreeNodes(const InitialBlock& ib, unsigned ny, unsigned n, bool fillInside = false);
+		static vec3 latticeNode(const InitialBlock& ib, unsigned long long j);
+
+	private:
+		const SPHconfig& config;
+		const Bounds& b;
+		std::vector<InitialBlock> initialBlocks;
+		std::vector<unsigned> freeNodes;
+};
+
+template <typename F>
+void InitialState::generate(F set) const {
+	const unsigned n = config.particleN;
+	const unsigned threadN = std::max(1u, std::thread::hardware_concurrency());
+	auto range = [&](unsigned t) {
+		for(unsigned i = (unsigned long long)n*t/threadN; i < (unsigned long long)n*(t+1)/threadN; ++i) {
+			vec3 pos, vel;
+			particle(i, pos, vel);
+			set(i, pos, vel);
+		}
+	};
+	std::vector<std::thread> threads;
+	for(unsigned t = 1; t < threadN; ++t)
+		threads.emplace_back(range, t);
+	range(0);
+	for(std::thread& t : threads)
+		t.join();
+}
+
+#endif /* INITIALSTATE_HPP_26_10_19_19_12_05 */
@@ -1,5 +1,7 @@
 #define _USE_MATH_DEFINES
 #include <memory>
+#include <chrono>
+#include <thread>
 #include <sstream>
 #include <iomanip>
 #include <GL/glew.h>
@@ -8,26 +10,55 @@
 #include <GL/freeglut.h>
 #include "utils.hpp"
 #include "application.hpp"
-#include "sphGpu.hpp"
-#include "sphCpu.hpp"
+#include "sphRegistry.hpp"
+#include "benchmark.hpp"
+#include "validation.hpp"
+#include "sweep.hpp"
+#include "domain.hpp"
+#include "glContext.hpp"
 
 ///////////////////////////// BEGINNING OF CONFIGURATION ////////////////////////////////
 
 unsigned WinSize = 1024;
 
-unsigned ParticleN = 1024*8; // must be power of two
-unsigned SubdivisionN = 8; // must be power of two
-vec3 BoxSize{2,2,2};
+// simulation parameters (particles, grid, box, SPH coefficients, backend) - the defaults are in scene.hpp,
+// they are overridden by a scene file (--scene), --set key=value and the positional arguments
+Scene scene;
 
-const float Step = 0.005; // [seconds]
-const float H = 0.1;
-const float M = 32;
-const float Rho0 = 1;
-const float K = 2.4;
-const float Mu = 2048;
+std::string ShaderCacheDir = "shadercache"; // linked shader programs (and autotuned workgroup sizes) are cached here, empty disables the cache
+bool AutotuneWorkgroups = false; // measure the workgroup sizes of the compute shaders on this device
+bool IncrementalRebinning = false; // re-sort only the particles which changed their cell
+bool TiledTraversal = false; // SPHcpu: cell-by-cell pair loops against contiguous tiles of the neighbours
+float RebinThreshold = 0.05; // fraction of the particles which changed their cell above which the grid is rebuilt from scratch
+bool LazyReorder = false; // SPHgpu: the particle data are accessed through the sorted records, sorted physically only now and then
+unsigned ReorderPeriod = 16; // lazy reorder: the particle data are sorted at least every this many steps
+float ReorderThreshold = 0.1; // lazy reorder: ... or when the cell changes since the last sort exceed this fraction of the particles
+std::string OutOfCoreDir = "outofcore"; // outofcore backend: the memory-mapped particle files are created here
+unsigned SlabLayers = 4; // outofcore backend: cell layers along x resident at once (plus a layer of halo on each side)
+
+unsigned BenchmarkStepN = 0; // run this many steps without drawing, report the timing and exit (0 - interactive mode)
+bool BenchmarkNoAlloc = false; // benchmark fails if the steady-state step allocates on the heap
+
+unsigned ValidatePeriod = 0; // run SPHcpu and SPHgpu in lockstep and compare them every this many steps (0 - off)
+unsigned ValidateStepN = 100;
+ValidationTolerances Tolerances;
+
+bool RunHeadless = false; // run scene.stepN steps without drawing, print the RunResult line and exit
+bool Headless = false; // EGL context without a window (surfaceless or pbuffer), automatic for the modes which do not draw when there is no display
+bool RunSweep = false; // run the scene for all the combinations of its swept parameters, each in a separate process
+unsigned SweepJobN = std::thread::hardware_concurrency();
+bool RunEnsemble = false; // run the sweep in this process as a single GPU ensemble instead of separate processes
+std::string ExportName; // publish the particle state after every step to this POSIX shared memory object, e.g. /sph (empty - off)
+unsigned ExportFrameN = 4; // frames of the shared memory ring
+std::string HealthFile; // CSV time series of the grid occupancy, the neighbour candidates and the density error (empty - off)
+unsigned HealthPeriod = 1; // collect the health metrics every this many steps
+std::string MeshDir; // write the fluid surface (OBJ) and the meshing times to this directory (empty - off)
+unsigned MeshPeriod = 10; // mesh the surface every this many steps
+SurfaceConfig MeshConfig; // marching cubes voxels per grid cell and the iso level
+unsigned DomainN = 0; // run scene.stepN steps on the CPU split into this many slabs, each in a separate process (0 - off)
+unsigned ScalingDomainN = 0; // strong and weak scaling of the decomposed run up to this many domains (0 - off)
+unsigned ObstacleScalingN = 0; // collision cost of up to this many copies of the scene's obstacles (0 - off)
 
-using SPHimpl = SPHgpu;
-//using SPHimpl = SPHcpu;
 
 ///////////////////////////// END OF CONFIGURATION ////////////////////////////////
 std::unique_ptr<SPHconfig> config;
@@ -86,91 +117,284 @@ static void HandleKeys(unsigned char key, int /*x*/, int /*y*/) {
 			config->Rho0 *= 2;
 			break;
   }
-	cout << "step: " << Step << endl;
-	cout << "h: " << H << endl;
-	cout << "m: " << M << endl;
-	cout << "k: " << K << endl;
-	cout << "mu: " << Mu << endl;
-	cout << "rho0: " << Rho0 << endl;
+	cout << "step: " << config->Step << endl;
+	cout << "h: " << config->H << endl;
+	cout << "m: " << config->M << endl;
+	cout << "k: " << config->K << endl;
+	cout << "mu: " << config->Mu << endl;
+	cout << "rho0: " << config->Rho0 << endl;
 	cout << endl;
 }
 void idleFunc() {
 	app->update();
 	ostringstream title;
 	title << "SPH demo - avg frame time: " << std::fixed << setw(8) << setprecision(2) << app->avgFrameTime << " [ms]";
+	if(config->IncrementalRebinning)
+		title << " - rebinned particles: " << setw(6) << setprecision(2) << app->sph->rebinnedFraction*100 << " [%]" << (app->sph->fullRebuild ? " (full rebuild)" : "");
+	if(config->LocalTimeStepping)
+		title << " - saved particle updates: " << app->sph->savedParticleUpdates;
 	glutSetWindowTitle(title.str().c_str());
   glutPostRedisplay();
 }
 
 int main(int argc, char* argv[]) {
-	cout << "usage: " << argv[0] << " [particleN [subdivisionN [boxSize [windowSize]]]]\n";
-	if(argc >= 2) ParticleN = std::stoi(argv[1]);
-	if(argc >= 3) SubdivisionN = std::stoi(argv[2]);
-	if(argc >= 4) BoxSize = {std::stoi(argv[3]), std::stoi(argv[3]), std::stoi(argv[3])};
-	if(argc >= 5) WinSize = std::stoi(argv[4]);
-
-	double p = log2(ParticleN);
-	if(ParticleN < 1024 || p != int(p)) {
-		std::cerr << "ParticleN must be at least 1024 and it must be a power of two\n";
-		exit(1);
+	auto startupBegin = chrono::steady_clock::now();
+	cout << "usage: " << argv[0] << " [--scene file] [--set key=value]... [--headless] [--run | --sweep [--jobs n | --ensemble] | --domains n | --scaling maxDomains | --obstacle-scaling maxObstacles] [--export shmName [--export-frames n]] [--health file.csv [--health-period steps]] [--mesh dir [--mesh-period steps] [--mesh-samples n]] [--backend name|auto] [--shader-cache dir] [--autotune] [--incremental-rebin [--rebin-threshold fraction]] [--lazy-reorder [--reorder-period steps] [--reorder-threshold fraction]] [--tiled] [--out-of-core-dir dir] [--slab-layers n] [--benchmark steps [--no-alloc]] [--validate period [--validate-steps steps] [--tolerance-{position,velocity,density,cells} value]] [particleN [subdivisionN [boxSize [windowSize]]]]\n";
+	vector<string> args;
+	vector<string> sweepArgs; // passed to the processes of the sweep
+	string sceneFile;
+	for(int i = 1; i < argc; ++i) {
+		int optionBegin = i;
+		string a = argv[i];
+		if(a == "--scene" && i+1 < argc) {
+			sceneFile = argv[++i];
+			if(!scene.load(sceneFile))
+				exit(1);
+			continue;
+		}
+		else if(a == "--sweep") {
+			RunSweep = true;
+			continue;
+		}
+		else if(a == "--jobs" && i+1 < argc) {
+			SweepJobN = std::stoi(argv[++i]);
+			continue;
+		}
+		else if(a == "--ensemble") {
+			RunEnsemble = true;
+			continue;
+		}
+		else if(a == "--set" && i+1 < argc) {
+			string kv = argv[++i];
+			size_t eq = kv.find('=');
+			if(eq == string::npos || !scene.set(kv.substr(0, eq), kv.substr(eq+1))) {
+				cerr << "Invalid parameter " << kv << endl;
+				exit(1);
+			}
+		}
+		else if(a == "--run")
+			RunHeadless = true;
+		else if(a == "--headless")
+			Headless = true;
+		else if(a == "--export" && i+1 < argc)
+			ExportName = argv[++i];
+		else if(a == "--export-frames" && i+1 < argc)
+			ExportFrameN = std::stoi(argv[++i]);
+		else if(a == "--health" && i+1 < argc)
+			HealthFile = argv[++i];
+		else if(a == "--health-period" && i+1 < argc)
+			HealthPeriod = std::stoi(argv[++i]);
+		else if(a == "--mesh" && i+1 < argc)
+			MeshDir = argv[++i];
+		else if(a == "--mesh-period" && i+1 < argc)
+			MeshPeriod = std::stoi(argv[++i]);
+		else if(a == "--mesh-samples" && i+1 < argc)
+			MeshConfig.samplesPerCell = std::max(1, std::stoi(argv[++i]));
+		else if(a == "--domains" && i+1 < argc)
+			DomainN = std::stoi(argv[++i]);
+		else if(a == "--scaling" && i+1 < argc)
+			ScalingDomainN = std::stoi(argv[++i]);
+		else if(a == "--obstacle-scaling" && i+1 < argc)
+			ObstacleScalingN = std::stoi(argv[++i]);
+		else if(a == "--backend" && i+1 < argc)
+			scene.backend = argv[++i];
+		else if(a == "--shader-cache" && i+1 < argc)
+			ShaderCacheDir = argv[++i];
+		else if(a == "--autotune")
+			AutotuneWorkgroups = true;
+		else if(a == "--incremental-rebin")
+			IncrementalRebinning = true;
+		else if(a == "--rebin-threshold" && i+1 < argc)
+			RebinThreshold = std::stof(argv[++i]);
+		else if(a == "--lazy-reorder")
+			LazyReorder = true;
+		else if(a == "--reorder-period" && i+1 < argc)
+			ReorderPeriod = std::stoi(argv[++i]);
+		else if(a == "--reorder-threshold" && i+1 < argc)
+			ReorderThreshold = std::stof(argv[++i]);
+		else if(a == "--tiled")
+			TiledTraversal = true;
+		else if(a == "--out-of-core-dir" && i+1 < argc)
+			OutOfCoreDir = argv[++i];
+		else if(a == "--slab-layers" && i+1 < argc)
+			SlabLayers = std::max(1, std::stoi(argv[++i]));
+		else if(a == "--benchmark" && i+1 < argc)
+			BenchmarkStepN = std::stoi(argv[++i]);
+		else if(a == "--no-alloc")
+			BenchmarkNoAlloc = true;
+		else if(a == "--validate" && i+1 < argc)
+			ValidatePeriod = std::stoi(argv[++i]);
+		else if(a == "--validate-steps" && i+1 < argc)
+			ValidateStepN = std::stoi(argv[++i]);
+		else if(a == "--tolerance-position" && i+1 < argc)
+			Tolerances.position = std::stof(argv[++i]);
+		else if(a == "--tolerance-velocity" && i+1 < argc)
+			Tolerances.velocity = std::stof(argv[++i]);
+		else if(a == "--tolerance-density" && i+1 < argc)
+			Tolerances.density = std::stof(argv[++i]);
+		else if(a == "--tolerance-cells" && i+1 < argc)
+			Tolerances.cellRecords = std::stof(argv[++i]);
+		else
+			args.push_back(a);
+		sweepArgs.insert(sweepArgs.end(), argv+optionBegin, argv+i+1);
 	}
-	p = log2(SubdivisionN);
-	if(SubdivisionN < 1 || p != int(p)) {
-		std::cerr << "SubdivisionN must be a power of two, >=1\n";
+	if(args.size() >= 1) scene.particleN = std::stoi(args[0]);
+	if(args.size() >= 2) scene.subdivisionN = std::stoi(args[1]);
+	if(args.size() >= 3) scene.boxSize = vec3(std::stof(args[2]));
+	if(args.size() >= 4) WinSize = std::stoi(args[3]);
+
+	string sceneError = scene.validate();
+	if(!sceneError.empty()) {
+		std::cerr << sceneError << endl;
 		exit(1);
 	}
+	if(RunSweep && !RunEnsemble) {
+		if(sceneFile.empty()) {
+			cerr << "The sweep needs a scene file\n";
+			exit(1);
+		}
+		return runSweep(argv[0], sceneFile, sweepArgs, scene, SweepJobN) ? 0 : EXIT_FAILURE;
+	}
+	// the domains are forked processes without the GL context
+	if(ScalingDomainN)
+		return runScalingBenchmark(scene, ScalingDomainN) ? 0 : EXIT_FAILURE;
+	if(DomainN) {
+		DecompositionResult r;
+		if(!runDecomposed(scene, DomainN, r))
+			return EXIT_FAILURE;
+		cout << r;
+		return r.nan ? EXIT_FAILURE : 0;
+	}
 
-	config.reset(new SPHconfig(ParticleN, SubdivisionN));
+	config.reset(new SPHconfig(scene.particleN, scene.subdivisionN));
 
-	config->Step = Step;
-	config->H = H;
-	config->M = M;
-	config->Rho0 = Rho0;
-	config->K = K;
-	config->Mu = Mu;
+	scene.apply(*config);
+	config->AutotuneWorkgroups = AutotuneWorkgroups;
+	config->IncrementalRebinning = IncrementalRebinning;
+	config->RebinThreshold = RebinThreshold;
+	config->LazyReorder = LazyReorder;
+	config->ReorderPeriod = ReorderPeriod;
+	config->ReorderThreshold = ReorderThreshold;
+	config->TiledTraversal = TiledTraversal;
+	config->OutOfCoreDir = OutOfCoreDir;
+	config->SlabLayers = SlabLayers;
 
-  glutInit(&argc, argv);
 #ifdef DEBUG
 	cout << "Debug build\n";
-	glutInitContextFlags (GLUT_CORE_PROFILE | GLUT_DEBUG);
 #else
 	cout << "Release build\n";
-	glutInitContextFlags (GLUT_CORE_PROFILE);
 #endif
-  glutInitWindowSize(WinSize, WinSize);
-  glutInitDisplayMode( GLUT_DOUBLE | GLUT_RGBA );
-	glutCreateWindow("SPH demo");
-
-	if(glewInit()) {
-		cerr << "Cannot initialize GLEW\n";
-		exit(EXIT_FAILURE);
-	}
-#ifdef DEBUG
-	if(glDebugMessageCallback){
-		cout << "Register OpenGL debug callback " << endl;
-		glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
-		glDebugMessageCallback(GLDEBUGPROC(openglCallbackFunction), nullptr);
-		GLuint unusedIds = 0;
-		glDebugMessageControl(GL_DONT_CARE,
-				GL_DONT_CARE,
-				GL_DONT_CARE,
-				0,
-				&unusedIds,
-				true);
+	// the modes which do not draw run without the window system if asked to or if there is none
+	bool interactive = !(RunHeadless || BenchmarkStepN || ValidatePeriod || RunSweep || ObstacleScalingN);
+	if(Headless && interactive) {
+		cerr << "The interactive mode needs a window, --headless works with --run, --benchmark, --obstacle-scaling, --validate and --sweep --ensemble\n";
+		exit(1);
 	}
-	else
-		cout << "glDebugMessageCallback not available" << endl;
-#endif
+	if(Headless || (!interactive && !getenv("DISPLAY") && !getenv("WAYLAND_DISPLAY")))
+		Headless = true;
+	if(!(Headless ? createHeadlessContext() : createWindowContext(argc, argv, WinSize, "SPH demo")) || !initGlFunctions())
+		exit(EXIT_FAILURE);
 
-	std::cout << "# of particles: " << ParticleN << std::endl;
-	std::cout << "level of subdivision: " << SubdivisionN << std::endl;
+	std::cout << "# of particles: " << scene.particleN << std::endl;
+	std::cout << "level of subdivision: " << scene.subdivisionN << std::endl;
 
-  glutDisplayFunc(DrawImage);
-  glutKeyboardFunc(HandleKeys);
-  glutIdleFunc(idleFunc);
+	if(!Headless) {
+		glutDisplayFunc(DrawImage);
+		glutKeyboardFunc(HandleKeys);
+		glutIdleFunc(idleFunc);
+	}
 
-	Bounds b(BoxSize);
-	app.reset(new Application(std::unique_ptr<SPH>(new SPHimpl(*config, b)), b));
+	setProgramBinaryCacheDir(ShaderCacheDir);
+	if(RunSweep)
+		return runEnsembleSweep(scene) ? 0 : EXIT_FAILURE;
+	if(ObstacleScalingN)
+		return runObstacleBenchmark(scene, *config, ObstacleScalingN, BenchmarkStepN ? BenchmarkStepN : 50) ? 0 : EXIT_FAILURE;
+	Bounds b(scene.boxSize);
+	if(!scene.bakeObstacles(b))
+		exit(1);
+	if(ValidatePeriod) {
+		std::unique_ptr<SPH> reference = SPHregistry::instance().create("cpu", *config, b);
+		std::unique_ptr<SPH> tested = SPHregistry::instance().create(scene.backend, *config, b);
+		if(!tested) {
+			cerr << "Unknown backend " << scene.backend << endl;
+			exit(1);
+		}
+		LockstepValidator validator(*reference, *tested, ValidatePeriod, Tolerances);
+		bool passed = true;
+		for(unsigned i = 0; i < ValidateStepN; ++i) {
+			if(validator.step()) {
+				cout << validator.lastReport << endl;
+				passed = passed && validator.lastReport.passed;
+			}
+		}
+		cout << "validation " << (passed ? "passed" : "FAILED") << endl;
+		return passed ? 0 : EXIT_FAILURE;
+	}
+	// the window needs a backend which draws, "auto" picks only among those
+	const bool drawing = interactive;
+	std::string backendName;
+	std::unique_ptr<SPH> sph = SPHregistry::instance().create(scene.backend, *config, b, drawing, &backendName);
+	if(!sph) {
+		cerr << "Unknown backend " << scene.backend << ", available: auto";
+		for(const string& name : SPHregistry::instance().names())
+			cerr << ", " << name;
+		cerr << endl;
+		exit(1);
+	}
+	if(drawing && !SPHregistry::instance().capabilities(backendName)->draws) {
+		cerr << "The " << backendName << " backend does not draw, it works with --run, --benchmark and --validate\n";
+		exit(1);
+	}
+	std::unique_ptr<SharedStateWriter> exporter;
+	if(!ExportName.empty()) {
+		exporter.reset(new SharedStateWriter(ExportName, std::max(1u, ExportFrameN), *config, b));
+		if(!exporter->valid())
+			exit(1);
+	}
+	std::unique_ptr<HealthLog> healthLog;
+	if(!HealthFile.empty()) {
+		healthLog.reset(new HealthLog(HealthFile, HealthPeriod));
+		if(!healthLog->valid()) {
+			cerr << "Could not write " << HealthFile << endl;
+			exit(1);
+		}
+	}
+	std::unique_ptr<SurfaceWriter> surfaceWriter;
+	if(!MeshDir.empty()) {
+		surfaceWriter.reset(new SurfaceWriter(MeshDir, MeshPeriod, MeshConfig));
+		if(!surfaceWriter->valid()) {
+			cerr << "Could not write to " << MeshDir << endl;
+			exit(1);
+		}
+	}
+	if(RunHeadless) {
+		RunResult r = runHeadless(*sph, *config, b, scene.stepN, 10, exporter.get(), healthLog.get(), surfaceWriter.get());
+		cout << r << endl;
+		cout << "initialization: " << r.initTime << " [ms]\n";
+		if(r.settledStepN)
+			cout << "time to the first stable step: " << r.settleTime << " [s] (step " << r.settledStepN << ")\n";
+		else
+			cout << "time to the first stable step: not settled in " << r.stepN << " steps\n";
+		if(surfaceWriter)
+			surfaceWriter->report(cout);
+		return 0;
+	}
+	app.reset(new Application(std::move(sph), b));
+	app->exporter = std::move(exporter);
+	app->healthLog = std::move(healthLog);
+	app->surfaceWriter = std::move(surfaceWriter);
+	cout << "startup time: " << chrono::duration<double, milli>(chrono::steady_clock::now() - startupBegin).count() << " ms\n";
+
+	if(BenchmarkStepN) {
+		const unsigned warmupStepN = 3;
+		BenchmarkResult r = runBenchmark(*app->sph, warmupStepN, BenchmarkStepN);
+		cout << r;
+		if(BenchmarkNoAlloc && r.allocationsPerStep > 0) {
+			cerr << "The simulation step allocates on the heap\n";
+			return EXIT_FAILURE;
+		}
+		return 0;
+	}
   glutMainLoop();
   return 0;
 }
@@ -0,0 +1,215 @@
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include "scene.hpp"
+using namespace std;
+
+bool Scene::load(const std::string& fileName) {
+	ifstream f(fileName);
+	if(!f) {
+		cerr << "Could not open " << fileName << endl;
+		return false;
+	}
+	string line;
+	unsigned lineN = 0;
+	while(getline(f, line)) {
+		++lineN;
+		line = line.substr(0, line.find('#'));
+		istringstream s(line);
+		string key;
+		if(!(s >> key))
+			continue;
+		string value;
+		getline(s >> ws, value);
+		if(!set(key, value)) {
+			cerr << fileName << ":" << lineN << ": invalid line: " << line << endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Scene::set(const std::string& key, const std::string& value) {
+	istringstream s(value);
+	if(key == "particleN")
+		s >> particleN;
+	else if(key == "subdivisionN")
+		s >> subdivisionN;
+	else if(key == "box")
+		s >> boxSize;
+	else if(key == "step")
+		s >> step;
+	else if(key == "h")
+		s >> h;
+	else if(key == "m")
+		s >> m;
+	else if(key == "rho0")
+		s >> rho0;
+	else if(key == "k")
+		s >> k;
+	else if(key == "mu")
+		s >> mu;
+	else if(key == "solver") {
+		string name;
+		s >> name;
+		if(name == "wcsph")
+			solver = PressureSolver::WCSPH;
+		else if(name == "pcisph")
+			solver = PressureSolver::PCISPH;
+		else
+			return false;
+	}
+	else if(key == "minPressureIterations")
+		s >> minPressureIterations;
+	else if(key == "maxPressureIterations")
+		s >> maxPressureIterations;
+	else if(key == "densityTolerance")
+		s >> densityTolerance;
+	else if(key == "localTimeStepping")
+		s >> localTimeStepping;
+	else if(key == "maxTimeStepLevel")
+		s >> maxTimeStepLevel;
+	else if(key == "timeStepCfl")
+		s >> timeStepCfl;
+	else if(key == "block") {
+		FluidBlock b;
+		s >> b.min >> b.max;
+		fluidBlocks.push_back(b);
+	}
+	else if(key == "layout") {
+		string name;
+		s >> name;
+		if(name == "random")
+			layout = InitialLayout::Random;
+		else if(name == "lattice")
+			layout = InitialLayout::Lattice;
+		else
+			return false;
+	}
+	else if(key == "jitter")
+		s >> latticeJitter;
+	else if(key == "seed")
+		s >> seed;
+	else if(key == "obstacle") {
+		Obstacle o;
+		if(!(s >> o.file))
+			return false;
+		// the scale and the offset are optional
+		float scale;
+		if(s >> scale) {
+			o.scale = scale;
+			vec3 offset;
+			if(s >> offset)
+				o.offset = offset;
+		}
+		obstacles.push_back(o);
+		return s.eof();
+	}
+	else if(key == "sdfResolution")
+		s >> sdfResolution;
+	else if(key == "backend")
+		s >> backend;
+	else if(key == "steps")
+		s >> stepN;
+	else if(key == "output")
+		s >> output;
+	else if(key == "sweep") {
+		Sweep sw;
+		s >> sw.key;
+		string v;
+		while(s >> v) {
+			float from, to, by;
+			char c1, c2;
+			istringstream range(v);
+			if(range >> from >> c1 >> to >> c2 >> by && c1 == ':' && c2 == ':' && by > 0) {
+				// the tolerance keeps the upper bound despite rounding
+				for(float x = from; x <= to + by*1e-3f; x += by) {
+					ostringstream xs;
+					xs << x;
+					sw.values.push_back(xs.str());
+				}
+			}
+			else
+				sw.values.push_back(v);
+		}
+		if(sw.values.empty() || sw.key == "sweep")
+			return false;
+		// a misspelled key or an invalid value fails here instead of running the defaults
+		for(const string& x : sw.values) {
+			Scene trial = *this;
+			if(!trial.set(sw.key, x)) {
+				cerr << "Invalid sweep value " << sw.key << "=" << x << endl;
+				return false;
+			}
+		}
+		sweeps.push_back(sw);
+		return true;
+	}
+	else
+		return false;
+	return !s.fail();
+}
+
+std::string Scene::validate() const {
+	double p = log2(particleN);
+	if(particleN < 1024 || p != int(p))
+		return "ParticleN must be at least 1024 and it must be a power of two";
+	p = log2(subdivisionN);
+	if(subdivisionN < 1 || p != int(p))
+		return "SubdivisionN must be a power of two, >=1";
+	for(const FluidBlock& b : fluidBlocks)
+		if(b.min.x >= b.max.x || b.min.y >= b.max.y || b.min.z >= b.max.z
+				|| b.min.x < 0 || b.min.y < 0 || b.min.z < 0
+				|| b.max.x > boxSize.x || b.max.y > boxSize.y || b.max.z > boxSize.z)
+			return "Fluid blocks must be non-empty and inside the box";
+	// the lattice of the prototype particle needs neighbours within the kernel radius
+	if(solver == PressureSolver::PCISPH && cbrt(m/rho0) >= h)
+		return "PCISPH needs the particle spacing at the rest density (m/rho0)^(1/3) below h";
+	if(localTimeStepping && (maxTimeStepLevel > 7 || timeStepCfl <= 0))
+		return "maxTimeStepLevel must be at most 7 and timeStepCfl positive";
+	if(latticeJitter < 0 || latticeJitter > 1)
+		return "The lattice jitter must be between 0 and 1";
+	if(!obstacles.empty() && sdfResolution < 2)
+		return "sdfResolution must be at least 2";
+	return {};
+}
+
+void Scene::apply(SPHconfig& config) const {
+	config.Step = step;
+	config.H = h;
+	config.M = m;
+	config.Rho0 = rho0;
+	config.K = k;
+	config.Mu = mu;
+	config.fluidBlocks = fluidBlocks;
+	config.Layout = layout;
+	config.LatticeJitter = latticeJitter;
+	config.Seed = seed;
+	config.Solver = solver;
+	config.MinPressureIterations = minPressureIterations;
+	config.MaxPressureIterations = maxPressureIterations;
+	config.DensityTolerance = densityTolerance;
+	config.LocalTimeStepping = localTimeStepping;
+	config.MaxTimeStepLevel = maxTimeStepLevel;
+	config.TimeStepCfl = timeStepCfl;
+}
+
+bool Scene::bakeObstacles(Bounds& b) const {
+	if(obstacles.empty())
+		return true;
+	auto begin = chrono::steady_clock::now();
+	shared_ptr<SignedDistanceField> sdf(new SignedDistanceField(b.min, b.max, sdfResolution));
+	for(const Obstacle& o : obstacles) {
+		Mesh mesh;
+		if(!mesh.loadObj(o.file))
+			return false;
+		mesh.transform(o.scale, o.offset);
+		sdf->addMesh(mesh);
+	}
+	double t = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+	cout << "obstacles: " << obstacles.size() << " meshes, " << sdf->triangleN << " triangles, "
+		<< sdf->size.x << "x" << sdf->size.y << "x" << sdf->size.z << " distance field baked in " << t << " ms\n";
+	b.obstacles = sdf;
+	return true;
+}
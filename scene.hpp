@@ -0,0 +1,90 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       scene.hpp
+ * \author     Ales Koblizek
+ * \date       2026/10/19
+ * \brief      Scene description - simulation parameters loaded from a file
+*/
+//----------------------------------------------------------------------------------------
+#ifndef SCENE_HPP_26_10_19_11_02_36
+#define SCENE_HPP_26_10_19_11_02_36 
+#include "sph.hpp"
+
+/// Static obstacle - closed triangle mesh placed into the box
+struct Obstacle {
+	std::string file; /// Wavefront OBJ
+	float scale = 1;
+	vec3 offset{0,0,0};
+};
+
+/// Values of a single parameter to be swept
+struct Sweep {
+	std::string key;
+	std::vector<std::string> values;
+};
+
+/* Scene description, the file contains one "key value..." per line, # starts a comment:
+ *   particleN 8192             number of particles (power of two, >= 1024)
+ *   subdivisionN 8             neighbour-search grid subdivisions (power of two)
+ *   box 2 2 2                  simulation bounds size
+ *   step 0.005                 simulation step [seconds]
+ *   h 0.1 / m 32 / rho0 1 / k 2.4 / mu 2048    SPH coefficients
+ *   solver pcisph              pressure solver: wcsph (equation of state with k) or pcisph
+ *   minPressureIterations 3 / maxPressureIterations 50 / densityTolerance 0.01    PCISPH iterations
+ *   localTimeStepping 1 / maxTimeStepLevel 3 / timeStepCfl 0.4    calm cells evaluate their forces every 2^level steps (cpu, wcsph)
+ *   block 0 0 0 1 2 1          fluid block (min, max) filled at the start, the whole box if there is none
+ *   layout lattice             initial particles: random (the default) or lattice (jittered cubic lattice at rest)
+ *   jitter 0.1 / seed 1        lattice jitter as a fraction of the spacing, seed of the initial state
+ *   obstacle rock.obj 0.5 1 0 1    static obstacle mesh, optionally scaled and then moved by the offset
+ *   sdfResolution 64           cells of the obstacle distance field along the longest side of the box
+ *   backend gpu                SPH implementation
+ *   steps 1000                 number of steps of a headless run
+ *   output sweep.csv           summary table of the sweep or of the scaling benchmark
+ *   sweep h 0.05 0.1 0.2       values of the parameter for the sweep runner, or
+ *   sweep k 1:4:0.5            from:to:step
+ */
+struct Scene {
+	unsigned particleN = 1024*8; // must be power of two
+	unsigned subdivisionN = 8; // must be power of two
+	vec3 boxSize{2,2,2};
+
+	float step = 0.005; // [seconds]
+	float h = 0.1;
+	float m = 32;
+	float rho0 = 1;
+	float k = 2.4;
+	float mu = 2048;
+	PressureSolver solver = PressureSolver::WCSPH;
+	unsigned minPressureIterations = 3;
+	unsigned maxPressureIterations = 50;
+	float densityTolerance = 0.01;
+	bool localTimeStepping = false;
+	unsigned maxTimeStepLevel = 3;
+	float timeStepCfl = 0.4;
+
+	std::vector<FluidBlock> fluidBlocks;
+	InitialLayout layout = InitialLayout::Random;
+	float latticeJitter = 0.1;
+	unsigned seed = 1;
+	std::vector<Obstacle> obstacles;
+	unsigned sdfResolution = 64;
+	std::string backend = "gpu";
+	unsigned stepN = 1000;
+	std::string output;
+	std::vector<Sweep> sweeps;
+
+	/// \return false on error
+	bool load(const std::string& fileName);
+	/// sets a single parameter, value has the same format as in the file
+	/// \return false on error
+	bool set(const std::string& key, const std::string& value);
+	/// \return empty string if the scene is valid, the error description otherwise
+	std::string validate() const;
+	/// copies the simulation parameters into the config
+	void apply(SPHconfig& config) const;
+	/// loads the obstacle meshes and bakes them into the distance field of the bounds
+	/// \return false on error
+	bool bakeObstacles(Bounds& b) const;
+};
+
+#endif /* SCENE_HPP_26_10_19_11_02_36 */
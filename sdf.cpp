@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include "sdf.hpp"
+using namespace std;
+using namespace glm;
+
+bool Mesh::loadObj(const std::string& fileName) {
+	ifstream f(fileName);
+	if(!f) {
+		cerr << "Could not open " << fileName << endl;
+		return false;
+	}
+	string line;
+	while(getline(f, line)) {
+		istringstream s(line);
+		string type;
+		s >> type;
+		if(type == "v") {
+			vec3 v;
+			s >> v;
+			vertices.push_back(v);
+		}
+		else if(type == "f") {
+			// "f 1 2 3", "f 1/1/1 2/2/2 3/3/3", negative indices are relative to the end
+			vector<unsigned> face;
+			string vertex;
+			while(s >> vertex) {
+				int i = stoi(vertex.substr(0, vertex.find('/')));
+				face.push_back(i > 0 ? i-1 : vertices.size()+i);
+			}
+			for(unsigned i = 2; i < face.size(); ++i)
+				triangles.push_back(uvec3(face[0], face[i-1], face[i]));
+		}
+	}
+	for(const uvec3& t : triangles)
+		if(t.x >= vertices.size() || t.y >= vertices.size() || t.z >= vertices.size()) {
+			cerr << fileName << ": invalid vertex index\n";
+			return false;
+		}
+	return true;
+}
+
+void Mesh::transform(float scale, const vec3& offset) {
+	for(vec3& v : vertices)
+		v = v*scale + offset;
+}
+
+/// closest point on triangle abc (Real-Time Collision Detection, 5.1.5)
+static vec3 closestPointOnTriangle(const vec3& p, const vec3& a, const vec3& b, const vec3& c) {
+	vec3 ab = b-a, ac = c-a, ap = p-a;
+	float d1 = dot(ab, ap), d2 = dot(ac, ap);
+	if(d1 <= 0 && d2 <= 0)
+		return a;
+	vec3 bp = p-b;
+	float d3 = dot(ab, bp), d4 = dot(ac, bp);
+	if(d3 >= 0 && d4 <= d3)
+		return b;
+	float vc = d1*d4 - d3*d2;
+	if(vc <= 0 && d1 >= 0 && d3 <= 0)
+		return a + ab*(d1/(d1-d3));
+	vec3 cp = p-c;
+	float d5 = dot(ab, cp), d6 = dot(ac, cp);
+	if(d6 >= 0 && d5 <= d6)
+		return c;
+	float vb = d5*d2 - d1*d6;
+	if(vb <= 0 && d2 >= 0 && d6 <= 0)
+		return a + ac*(d2/(d2-d6));
+	float va = d3*d6 - d5*d4;
+	if(va <= 0 && (d4-d3) >= 0 && (d5-d6) >= 0)
+		return b + (c-b)*((d4-d3)/((d4-d3)+(d5-d6)));
+	float denom = 1/(va+vb+vc);
+	return a + ab*(vb*denom) + ac*(vc*denom);
+}
+
+SignedDistanceField::SignedDistanceField(const vec3& _min, const vec3& max, unsigned resolution): min{_min}, triangleN{0} {
+	vec3 s = max-min;
+	spacing = std::max(s.x, std::max(s.y, s.z))/resolution;
+	band = 3*spacing;
+	for(int a = 0; a < 3; ++a)
+		size[a] = unsigned(ceil(s[a]/spacing)) + 1;
+	extent = vec3(size.x-1, size.y-1, size.z-1)*spacing;
+	values.assign(size.x*size.y*size.z, band);
+}
+
+void SignedDistanceField::addMesh(const Mesh& mesh) {
+	vector<float> unsignedDistance(values.size(), band);
+	// per grid column along x: the x coordinates where the column crosses the surface
+	vector<vector<float>> crossings(size.y*size.z);
+	auto nodePos = [&](int x, int y, int z) { return min + vec3(x,y,z)*spacing; };
+	auto toIndex = [&](float v, int axis) { return (v - min[axis])/spacing; };
+	for(const uvec3& t : mesh.triangles) {
+		const vec3& a = mesh.vertices[t.x];
+		const vec3& b = mesh.vertices[t.y];
+		const vec3& c = mesh.vertices[t.z];
+		vec3 lo = glm::min(a, glm::min(b, c));
+		vec3 hi = glm::max(a, glm::max(b, c));
+		int from[3], to[3];
+		for(int axis = 0; axis < 3; ++axis) {
+			from[axis] = std::max(0, int(ceil(toIndex(lo[axis]-band, axis))));
+			to[axis] = std::min(int(size[axis])-1, int(floor(toIndex(hi[axis]+band, axis))));
+		}
+		// narrow band of exact distances
+		for(int z = from[2]; z <= to[2]; ++z)
+			for(int y = from[1]; y <= to[1]; ++y)
+				for(int x = from[0]; x <= to[0]; ++x) {
+					vec3 p = nodePos(x,y,z);
+					float& d = unsignedDistance[x + size.x*(y + size.y*z)];
+					d = std::min(d, length(p - closestPointOnTriangle(p, a, b, c)));
+				}
+		// crossings of the x-columns, the columns are slightly offset so that they do not hit the edges exactly
+		const vec3 columnOffset(0, 1.3e-4f*spacing, 0.7e-4f*spacing);
+		int yFrom = std::max(0, int(ceil(toIndex(lo.y, 1)))), yTo = std::min(int(size.y)-1, int(floor(toIndex(hi.y, 1))));
+		int zFrom = std::max(0, int(ceil(toIndex(lo.z, 2)))), zTo = std::min(int(size.z)-1, int(floor(toIndex(hi.z, 2))));
+		float area = (b.y-a.y)*(c.z-a.z) - (c.y-a.y)*(b.z-a.z);
+		if(area == 0)
+			continue;
+		for(int z = std::max(0, zFrom-1); z <= zTo; ++z)
+			for(int y = std::max(0, yFrom-1); y <= yTo; ++y) {
+				vec3 q = nodePos(0,y,z) + columnOffset;
+				// barycentric coordinates of the column in the yz projection
+				float wa = ((b.y-q.y)*(c.z-q.z) - (c.y-q.y)*(b.z-q.z))/area;
+				float wb = ((c.y-q.y)*(a.z-q.z) - (a.y-q.y)*(c.z-q.z))/area;
+				float wc = 1 - wa - wb;
+				if(wa < 0 || wb < 0 || wc < 0)
+					continue;
+				crossings[y + size.y*z].push_back(wa*a.x + wb*b.x + wc*c.x);
+			}
+	}
+	// inside is where the number of crossings on the left is odd
+	for(unsigned z = 0; z < size.z; ++z)
+		for(unsigned y = 0; y < size.y; ++y) {
+			vector<float>& column = crossings[y + size.y*z];
+			sort(column.begin(), column.end());
+			unsigned crossed = 0;
+			for(unsigned x = 0; x < size.x; ++x) {
+				float px = min.x + x*spacing;
+				while(crossed < column.size() && column[crossed] < px)
+					++crossed;
+				unsigned i = x + size.x*(y + size.y*z);
+				float d = (crossed % 2) ? -unsignedDistance[i] : unsignedDistance[i];
+				values[i] = std::min(values[i], d);
+			}
+		}
+	triangleN += mesh.triangles.size();
+}
+
+float SignedDistanceField::distance(const vec3& p) const {
+	vec3 g = clamp((p - min)/spacing, vec3(0), vec3(size.x-1, size.y-1, size.z-1));
+	unsigned x = std::min(unsigned(g.x), size.x-2);
+	unsigned y = std::min(unsigned(g.y), size.y-2);
+	unsigned z = std::min(unsigned(g.z), size.z-2);
+	vec3 f = g - vec3(x,y,z);
+	float c00 = mix(value(x,y,z), value(x+1,y,z), f.x);
+	float c10 = mix(value(x,y+1,z), value(x+1,y+1,z), f.x);
+	float c01 = mix(value(x,y,z+1), value(x+1,y,z+1), f.x);
+	float c11 = mix(value(x,y+1,z+1), value(x+1,y+1,z+1), f.x);
+	return mix(mix(c00, c10, f.y), mix(c01, c11, f.y), f.z);
+}
+
+vec3 SignedDistanceField::normal(const vec3& p) const {
+	float e = spacing/2;
+	vec3 g(distance(p+vec3(e,0,0)) - distance(p-vec3(e,0,0)),
+			distance(p+vec3(0,e,0)) - distance(p-vec3(0,e,0)),
+			distance(p+vec3(0,0,e)) - distance(p-vec3(0,0,e)));
+	float l = length(g);
+	return l > 0 ? g/l : UP;
+}
@@ -0,0 +1,52 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       sdf.hpp
+ * \author     Ales Koblizek
+ * \date       2026/10/19
+ * \brief      Static obstacles - triangle meshes baked into a signed distance field
+*/
+//----------------------------------------------------------------------------------------
+#ifndef SDF_HPP_26_10_19_11_48_20
+#define SDF_HPP_26_10_19_11_48_20 
+#include "utils.hpp"
+
+/// Triangle mesh, must be closed (watertight) so that its inside is defined
+struct Mesh {
+	std::vector<vec3> vertices;
+	std::vector<glm::uvec3> triangles;
+
+	/// loads vertices and faces (polygons are triangulated as fans) from a Wavefront OBJ file
+	/// \return false on error
+	bool loadObj(const std::string& fileName);
+	void transform(float scale, const vec3& offset);
+};
+
+/* Signed distance to the obstacles sampled on a regular grid of nodes, negative inside.
+ * Only a narrow band around the surfaces holds exact distances, farther values are clamped to +-band.
+ * That is enough for the collision test (sign) and response (gradient).
+ */
+class SignedDistanceField {
+	public:
+		/// the grid covers [min,max], resolution is the number of cells along the longest side
+		SignedDistanceField(const vec3& min, const vec3& max, unsigned resolution);
+
+		/// adds the mesh (union with the obstacles already present)
+		void addMesh(const Mesh& mesh);
+
+		/// trilinear interpolation, clamped to the grid
+		float distance(const vec3& p) const;
+		/// points away from the obstacles
+		vec3 normal(const vec3& p) const;
+
+		float value(unsigned x, unsigned y, unsigned z) const { return values[x + size.x*(y + size.y*z)]; }
+
+		vec3 min; /// position of the first node
+		vec3 extent; /// from the first to the last node
+		float spacing; /// distance of neighbouring nodes
+		float band;
+		glm::uvec3 size; /// number of nodes along each axis
+		std::vector<float> values; /// x is the fastest changing index
+		unsigned triangleN; /// triangles baked so far
+};
+
+#endif /* SDF_HPP_26_10_19_11_48_20 */
@@ -0,0 +1,146 @@
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "sharedState.hpp"
+using namespace std;
+
+static size_t alignUp(size_t size) {
+	const size_t alignment = 64; // frames on separate cache lines
+	return (size + alignment - 1)/alignment*alignment;
+}
+
+int64_t monotonicNanoseconds() {
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return int64_t(t.tv_sec)*1000000000 + t.tv_nsec;
+}
+
+SharedStateWriter::SharedStateWriter(const std::string& _name, unsigned frameN, const SPHconfig& config, const Bounds& b):
+	name{_name}, header{nullptr}, size{0}, publishedN{0}
+{
+	uint64_t frameSize = alignUp(sizeof(SharedFrameHeader) + config.particleN*7*sizeof(float));
+	size = alignUp(sizeof(SharedStateHeader)) + frameN*frameSize;
+	// a fresh object: truncating the one of a previous run would make its readers still mapping it fault (SIGBUS),
+	// after the unlink they keep the old object
+	shm_unlink(name.c_str());
+	int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+	if(fd < 0) {
+		cerr << "Cannot create the shared memory " << name << endl;
+		return;
+	}
+	void* p = MAP_FAILED;
+	if(ftruncate(fd, size) == 0)
+		p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED) {
+		cerr << "Cannot map the shared memory " << name << endl;
+		shm_unlink(name.c_str());
+		return;
+	}
+	// ftruncate fills the object with zeros: no frame published, all the sequences even
+	header = static_cast<SharedStateHeader*>(p);
+	header->version = SharedStateHeader::VERSION;
+	header->frameN = frameN;
+	header->particleN = config.particleN;
+	header->frameSize = frameSize;
+	header->step = config.Step;
+	header->h = config.H;
+	header->m = config.M;
+	header->rho0 = config.Rho0;
+	header->k = config.K;
+	header->mu = config.Mu;
+	header->subdivisionN = config.SubdivisionN;
+	for(int a = 0; a < 3; ++a) {
+		header->boundsMin[a] = b.min[a];
+		header->boundsMax[a] = b.max[a];
+	}
+	// the readers check the magic last
+	atomic_thread_fence(memory_order_release);
+	header->magic = SharedStateHeader::MAGIC;
+}
+
+SharedStateWriter::~SharedStateWriter() {
+	if(!header)
+		return;
+	munmap(header, size);
+	// the readers which already mapped it keep their mapping
+	shm_unlink(name.c_str());
+}
+
+void SharedStateWriter::publish(const std::vector<vec3>& pos, const std::vector<vec3>& vel, const std::vector<float>& density) {
+	if(!header)
+		return;
+	char* frame = reinterpret_cast<char*>(header) + alignUp(sizeof(SharedStateHeader)) + publishedN%header->frameN*header->frameSize;
+	SharedFrameHeader* fh = reinterpret_cast<SharedFrameHeader*>(frame);
+	uint64_t sequence = fh->sequence.load(memory_order_relaxed);
+	fh->sequence.store(sequence+1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	fh->step = publishedN;
+	float* data = reinterpret_cast<float*>(frame + sizeof(SharedFrameHeader));
+	unsigned n = header->particleN;
+	memcpy(data, pos.data(), n*sizeof(vec3));
+	memcpy(data + 3*n, vel.data(), n*sizeof(vec3));
+	memcpy(data + 6*n, density.data(), n*sizeof(float));
+	fh->publishTime = monotonicNanoseconds();
+	fh->sequence.store(sequence+2, memory_order_release);
+	header->publishedN.store(++publishedN, memory_order_release);
+}
+
+SharedStateReader::SharedStateReader(const std::string& name): header{nullptr}, size{0} {
+	int fd = shm_open(name.c_str(), O_RDONLY, 0);
+	if(fd < 0)
+		return;
+	struct stat s;
+	void* p = MAP_FAILED;
+	if(fstat(fd, &s) == 0 && size_t(s.st_size) >= sizeof(SharedStateHeader))
+		p = mmap(nullptr, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED)
+		return;
+	size = s.st_size;
+	const SharedStateHeader* h = static_cast<const SharedStateHeader*>(p);
+	if(h->magic != SharedStateHeader::MAGIC || h->version != SharedStateHeader::VERSION
+			|| alignUp(sizeof(SharedStateHeader)) + h->frameN*h->frameSize > size) {
+		munmap(p, size);
+		return;
+	}
+	atomic_thread_fence(memory_order_acquire);
+	header = h;
+}
+
+SharedStateReader::~SharedStateReader() {
+	if(header)
+		munmap(const_cast<SharedStateHeader*>(header), size);
+}
+
+const SharedFrameHeader* SharedStateReader::frameHeader(uint64_t step) const {
+	const char* frame = reinterpret_cast<const char*>(header) + alignUp(sizeof(SharedStateHeader)) + step%header->frameN*header->frameSize;
+	return reinterpret_cast<const SharedFrameHeader*>(frame);
+}
+
+bool SharedStateReader::latest(SharedFrame& frame) const {
+	uint64_t publishedN = header->publishedN.load(memory_order_acquire);
+	if(publishedN == 0)
+		return false;
+	const SharedFrameHeader* fh = frameHeader(publishedN-1);
+	frame.sequence = fh->sequence.load(memory_order_acquire);
+	if(frame.sequence & 1)
+		return false;
+	frame.step = fh->step;
+	frame.publishTime = fh->publishTime;
+	const float* data = reinterpret_cast<const float*>(fh+1);
+	unsigned n = header->particleN;
+	frame.pos = data;
+	frame.vel = data + 3*n;
+	frame.density = data + 6*n;
+	// a newer step may have taken the frame between the loads
+	return frame.step == publishedN-1 && stillValid(frame);
+}
+
+bool SharedStateReader::stillValid(const SharedFrame& frame) const {
+	atomic_thread_fence(memory_order_acquire);
+	return frameHeader(frame.step)->sequence.load(memory_order_relaxed) == frame.sequence;
+}
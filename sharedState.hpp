@@ -0,0 +1,105 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       sharedState.hpp
+ * \author     Ales Koblizek
+ * \date       2026/10/19
+ * \brief      Particle state published to a POSIX shared-memory ring buffer for external readers
+*/
+//----------------------------------------------------------------------------------------
+#ifndef SHAREDSTATE_HPP_26_10_19_13_48_05
+#define SHAREDSTATE_HPP_26_10_19_13_48_05
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include "sph.hpp"
+
+/* Layout of the shared memory object:
+ *   SharedStateHeader
+ *   frameN times: SharedFrameHeader, positions (3 floats per particle), velocities (3 floats), densities (1 float),
+ *   every frame aligned to 64 bytes
+ * The frames are a ring: the step s goes to the frame s % frameN.
+ * Each frame has its own seqlock - the sequence is odd while the writer fills the frame, so a reader
+ * maps the frame in place and afterwards checks that the sequence did not change.
+ */
+struct SharedStateHeader {
+	static constexpr uint32_t MAGIC = 0x48505353; // "SSPH"
+	static constexpr uint32_t VERSION = 1;
+	uint32_t magic;
+	uint32_t version;
+	uint32_t frameN;
+	uint32_t particleN;
+	uint64_t frameSize; /// bytes of a frame including its header
+	// SPHconfig and the bounds at the start of the export
+	float step;
+	float h;
+	float m;
+	float rho0;
+	float k;
+	float mu;
+	uint32_t subdivisionN;
+	float boundsMin[3];
+	float boundsMax[3];
+	std::atomic<uint64_t> publishedN; /// frames published so far, the latest is publishedN-1 (written after the frame is complete)
+};
+
+struct SharedFrameHeader {
+	std::atomic<uint64_t> sequence; /// seqlock, odd while the frame is being written
+	uint64_t step; /// step index since the start of the export
+	int64_t publishTime; /// CLOCK_MONOTONIC [ns] when the frame was complete
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the seqlock needs lock-free 64-bit atomics shared between the processes");
+
+/// Writer side, owned by the simulation. Creates (and at the end removes) the shared memory object.
+class SharedStateWriter {
+	public:
+		/// \param name POSIX shared memory name, e.g. "/sph"
+		SharedStateWriter(const std::string& name, unsigned frameN, const SPHconfig& config, const Bounds& b);
+		~SharedStateWriter();
+		bool valid() const { return header != nullptr; }
+
+		/// copies the state to the next frame of the ring, never waits for the readers
+		void publish(const std::vector<vec3>& pos, const std::vector<vec3>& vel, const std::vector<float>& density);
+
+	private:
+		std::string name;
+		SharedStateHeader* header;
+		size_t size;
+		uint64_t publishedN;
+};
+
+/// Frame mapped in place, valid only until SharedStateReader::stillValid says otherwise
+struct SharedFrame {
+	uint64_t sequence;
+	uint64_t step;
+	int64_t publishTime; /// CLOCK_MONOTONIC [ns]
+	const float* pos; /// 3 floats per particle
+	const float* vel;
+	const float* density;
+};
+
+/// Reader side, maps the shared memory object read-only
+class SharedStateReader {
+	public:
+		SharedStateReader(const std::string& name);
+		~SharedStateReader();
+		bool valid() const { return header != nullptr; }
+		const SharedStateHeader& info() const { return *header; }
+
+		/// the latest complete frame, no copy
+		/// \return false if nothing was published yet or the writer is just overwriting it
+		bool latest(SharedFrame& frame) const;
+		/// \return true if the writer has not touched the frame since latest() - the data read from it is consistent
+		bool stillValid(const SharedFrame& frame) const;
+
+	private:
+		const SharedFrameHeader* frameHeader(uint64_t step) const;
+
+		const SharedStateHeader* header;
+		size_t size;
+};
+
+/// CLOCK_MONOTONIC [ns], the same clock in all the processes
+int64_t monotonicNanoseconds();
+
+#endif /* SHAREDSTATE_HPP_26_10_19_13_48_05 */
@@ -1,9 +1,10 @@
 #include "sph.hpp"
+#include "surface.hpp"
 using namespace std;
 using namespace glm;
 const float ParticleRad = 0.02;
 
-SPH::SPH(SPHconfig &_config, Bounds& _b): frameTime{0}, b{_b}, config{_config} {
+SPH::SPH(SPHconfig &_config, Bounds& _b): frameTime{0}, rebinnedFraction{0}, fullRebuild{false}, collisionTime{0}, pressureIterations{0}, savedParticleUpdates{0}, dispatchN{0}, movedBytes{0}, ioBytes{0}, ioWaitTime{0}, collectHealth{false}, health{}, b{_b}, config{_config} {
 	glGenVertexArrays(1, &vao);
 	glBindVertexArray(vao);
 
@@ -25,6 +26,33 @@ void SPH::draw() {
 	glDrawElementsInstanced(GL_QUADS, indexN, GL_UNSIGNED_INT, NULL, config.particleN);
 }
 
+float pcisphDelta(const SPHconfig& config) {
+	// neighbours on a cubic lattice with the spacing of the rest density
+	double spacing = cbrt(config.M/config.Rho0);
+	int n = int(ceil(config.H/spacing));
+	vec3 gradSum = {};
+	double gradDotSum = 0;
+	for(int x = -n; x <= n; ++x)
+		for(int y = -n; y <= n; ++y)
+			for(int z = -n; z <= n; ++z) {
+				vec3 grad = -wPresure1(vec3(x,y,z)*float(spacing), config.H);
+				gradSum += grad;
+				gradDotSum += dot(grad, grad);
+			}
+	double beta = 2*pow(config.Step*config.M/config.Rho0, 2);
+	return 1/(beta*(dot(gradSum, gradSum) + gradDotSum));
+}
+
+void SPH::extractSurface(const SurfaceConfig& sc, SurfaceMesh& mesh) {
+	vector<vec3> pos, vel;
+	vector<float> density;
+	vector<CellRecord> cellRecords;
+	getParticles(pos, vel);
+	getDensities(density);
+	getCellRecords(cellRecords);
+	::extractSurface(sc, config, b, pos, density, cellRecords, mesh);
+}
+
 void SPH::setParticlePositionAttrBuffer(int numPositionComponents) {
 	glBindVertexArray(vao);
 	glBindBuffer(GL_ARRAY_BUFFER, particlePositionBuff);
@@ -10,6 +10,10 @@
 #define SPH_HPP_20_01_07_21_09_53 
 #include "sphKernels.hpp"
 #include "bounds.hpp"
+#include "health.hpp"
+
+struct SurfaceConfig;
+struct SurfaceMesh;
 
 /// Used for grid-based neighbour search
 struct ParticleRecord {
@@ -23,6 +27,24 @@ struct CellRecord {
 	unsigned particleN;
 };
 
+/// Axis-aligned block of fluid present at the start of the simulation
+struct FluidBlock {
+	vec3 min;
+	vec3 max;
+};
+
+/// Computation of the pressure
+enum class PressureSolver {
+	WCSPH, /// weakly compressible - equation of state K*(density-Rho0)
+	PCISPH, /// predictive-corrective incompressible - the pressure is iterated until the predicted compression is below DensityTolerance
+};
+
+/// Placement of the particles at the start of the simulation (initialState.hpp)
+enum class InitialLayout {
+	Random, /// uniformly random in the fluid blocks - the overlapping particles push each other apart in the first steps
+	Lattice, /// jittered cubic lattice filling the fluid blocks, at rest
+};
+
 /// Holds SPH coefficients and other simulation parameters
 struct SPHconfig {
 	SPHconfig(unsigned _particleN, unsigned _subdivisionN): SubdivisionN{_subdivisionN}, particleN{_particleN}
@@ -35,8 +57,53 @@ struct SPHconfig {
 	float Mu; /// viscosity coefficient
 	const unsigned SubdivisionN; /// neighbour-search grid number of subdivisions in each dimension (must be power of two)
 	const unsigned particleN; /// numbe of particles
+	bool AutotuneWorkgroups = false; /// GPU implementation: measure the candidate workgroup sizes of each compute shader on this device (otherwise the cached winners are used)
+	bool IncrementalRebinning = false; /// re-sort only the particles which changed their cell since the last step
+	float RebinThreshold = 0.05; /// fraction of particles which changed their cell above which the grid is rebuilt from scratch
+	bool LazyReorder = false; /// SPHgpu: the particle data are accessed through the sorted records and physically sorted only now and then
+	unsigned ReorderPeriod = 16; /// lazy reorder: the data are sorted at least every this many steps
+	float ReorderThreshold = 0.1; /// lazy reorder: ... or when the cell changes since the last sort (summed over the steps) exceed this fraction of the particles
+	bool TiledTraversal = false; /// SPHcpu: the pair loops go cell by cell against the neighbour particles gathered into a contiguous tile
+	std::vector<FluidBlock> fluidBlocks; /// initial fluid, the particles fill the whole bounds if empty
+	InitialLayout Layout = InitialLayout::Random;
+	float LatticeJitter = 0.1; /// lattice layout: the particles are moved randomly by up to +-LatticeJitter/2 of the spacing along each axis
+	unsigned Seed = 1; /// initial state: seed of the counter-based random numbers
+	PressureSolver Solver = PressureSolver::WCSPH;
+	unsigned MinPressureIterations = 3; /// PCISPH
+	unsigned MaxPressureIterations = 50; /// PCISPH
+	float DensityTolerance = 0.01; /// PCISPH: max allowed predicted compression (density-Rho0)/Rho0
+	bool LocalTimeStepping = false; /// SPHcpu with WCSPH: the forces in the calm cells are evaluated only every 2^level steps
+	unsigned MaxTimeStepLevel = 3; /// local time stepping: the coarsest level
+	float TimeStepCfl = 0.4; /// local time stepping: allowed step of a cell is TimeStepCfl*min(H/speed, sqrt(H/acceleration))
+	std::string OutOfCoreDir = "outofcore"; /// SPHoutOfCore: directory of the memory-mapped particle files
+	unsigned SlabLayers = 4; /// SPHoutOfCore: cell layers along x computed together, the resident window is the slab and a layer on each side
 };
 
+/// PCISPH pressure scaling factor for the predicted density error (prototype particle with a full neighbourhood at the rest density)
+float pcisphDelta(const SPHconfig& config);
+
+/// WCSPH equation of state, shared by the CPU implementations (SPHcpu, SPHdomain)
+inline float wcsphPressure(const SPHconfig& config, float density) {
+	return config.K*(density-config.Rho0);
+}
+
+/// WCSPH: adds the density contribution of the neighbour at r = pos_i - pos_j
+inline void addWcsphDensity(const SPHconfig& config, const vec3& r, float& density) {
+	density += config.M*w(r, config.H);
+}
+
+/// WCSPH: adds the pressure and viscosity forces of the neighbour j on the particle i, r = pos_i - pos_j
+inline void addWcsphForces(const SPHconfig& config, const vec3& r, float pressureI, float pressureJ, float densityJ,
+		const vec3& velI, const vec3& velJ, vec3& fPressure, vec3& fViscosity) {
+	fPressure += config.M*(pressureI+pressureJ)/(2*densityJ)*wPresure1(r, config.H);
+	fViscosity += (velJ-velI)*float(config.Mu*config.M/densityJ*wViscosity2(r, config.H));
+}
+
+/// WCSPH: acceleration of a particle from the summed neighbour forces and the gravity
+inline vec3 wcsphAcceleration(const vec3& fPressure, const vec3& fViscosity, float density) {
+	vec3 fGravity = -UP*9.81f*density;
+	return (fViscosity + fPressure + fGravity)/density;
+}
 
 /* Base class for SPH implementation.
  * Draws the particles.
@@ -56,6 +123,19 @@ class SPH {
 		/// single simulation step
 		virtual void update() = 0;
 
+		/// particle positions and velocities in the current particle order of the implementation
+		virtual void getParticles(std::vector<vec3>& pos, std::vector<vec3>& vel) = 0;
+		/// replaces the simulation state, the neighbour-search grid is rebuilt in the next step
+		virtual void setParticles(const std::vector<vec3>& pos, const std::vector<vec3>& vel) = 0;
+		/// index of each particle (in the order of getParticles) in the last reset or setParticles, follows the particles through the reorders
+		virtual void getParticleIDs(std::vector<unsigned>& id) = 0;
+		/// particle densities computed in the last step, in the same order as getParticles
+		virtual void getDensities(std::vector<float>& density) = 0;
+		/// neighbour-search grid from the last step
+		virtual void getCellRecords(std::vector<CellRecord>& cellRecords) = 0;
+		/// triangle mesh of the fluid surface (surface.hpp), by default extracted on the CPU from the state above
+		virtual void extractSurface(const SurfaceConfig& sc, SurfaceMesh& mesh);
+
 	protected:
 		template <typename T>
 			void bufferData(GLuint buffer, const std::vector<T>& data, GLenum usage) {
@@ -63,7 +143,13 @@ class SPH {
 				glBindBuffer(GL_ARRAY_BUFFER, buffer);
 				glBufferData(GL_ARRAY_BUFFER, data.size()*sizeof(T), data.data(), usage);
 			}
-
+		/// updates the buffer previously allocated by bufferData without reallocating it
+		template <typename T>
+			void bufferSubData(GLuint buffer, const std::vector<T>& data) {
+				glBindVertexArray(vao);
+				glBindBuffer(GL_ARRAY_BUFFER, buffer);
+				glBufferSubData(GL_ARRAY_BUFFER, 0, data.size()*sizeof(T), data.data());
+			}
 
 	private:
 		/// initializes the sphere mesh used for particle visualization
@@ -71,6 +157,17 @@ class SPH {
 
 	public:
 		float frameTime; /// the derived classes should write here the time required for simulation step
+		float rebinnedFraction; /// the derived classes should write here the fraction of particles which changed their cell during the last step
+		bool fullRebuild; /// the derived classes should write here whether the grid of the last step was rebuilt from scratch (the first step, over config.RebinThreshold)
+		float collisionTime; /// the derived classes may write here the time of the collision handling in the last step [ms], if they measure it separately (the GPU times its update pass, the obstacle collision is fused into it)
+		unsigned pressureIterations; /// the derived classes should write here the number of PCISPH iterations of the last step
+		unsigned long long savedParticleUpdates; /// the derived classes should write here the particle updates skipped by the local time stepping since the reset
+		unsigned dispatchN; /// the GPU derived classes should write here the number of compute dispatches of the last step
+		unsigned long long movedBytes; /// the GPU derived classes should write here the estimated buffer traffic of the last step (own elements of the invocations, without the neighbour reads)
+		unsigned long long ioBytes; /// the out-of-core derived classes should write here the particle data streamed through the memory in the last step
+		float ioWaitTime; /// the out-of-core derived classes should write here the time the last step waited for the prefetched data [ms]
+		bool collectHealth; /// set by the caller before update(), the derived classes then fill health
+		HealthMetrics health; /// of the last step with collectHealth
 
 	protected:
 		GLuint particlePositionBuff;
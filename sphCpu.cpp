@@ -1,72 +1,268 @@
 #include <algorithm>
+#include <chrono>
+#include <limits>
+#include <numeric>
+#include "initialState.hpp"
 #include "sphCpu.hpp"
+#include "sphRegistry.hpp"
 #include "utils.hpp"
 using namespace std;
 using namespace glm;
 
-SPHcpu::SPHcpu(SPHconfig &config, Bounds& _b): SPH{config, _b} {
+static SPHregistration registration("cpu", [](SPHconfig& config, Bounds& b) { return unique_ptr<SPH>(new SPHcpu(config, b)); });
+
+SPHcpu::SPHcpu(SPHconfig &config, Bounds& _b): SPH{config, _b}, cellRecordsValid{false} {
 	particlePosTmp.resize(config.particleN);
 	particleVel.resize(config.particleN,{});
 	particlePos.resize(config.particleN);
+	particleAcceleration.resize(config.particleN);
+	particleID.resize(config.particleN);
 	reset();
 	cellRecords.resize(config.SubdivisionN*config.SubdivisionN*config.SubdivisionN);
 	particleRecords.resize(config.particleN);
+	workspace.density.resize(config.particleN);
+	workspace.pressure.resize(config.particleN);
+	workspace.particleVelTmp.resize(config.particleN);
+	workspace.particleIDTmp.resize(config.particleN);
+	workspace.particleRecordsTmp.resize(config.particleN);
+	workspace.changedRecords.reserve(config.particleN);
+	workspace.accelerationNp.resize(config.particleN);
+	workspace.accelerationP.resize(config.particleN);
+	workspace.predictedPos.resize(config.particleN);
+	workspace.predictedDensity.resize(config.particleN);
+	if(config.TiledTraversal) {
+		// the tile never holds more than all the particles
+		workspace.tilePos.resize(config.particleN);
+		workspace.tileVel.resize(config.particleN);
+		workspace.tileDensity.resize(config.particleN);
+		workspace.tilePressure.resize(config.particleN);
+	}
+	if(config.LocalTimeStepping) {
+		if(config.Solver != PressureSolver::WCSPH)
+			cerr << "Local time stepping supports only the WCSPH solver, ignored\n";
+		workspace.densityTmp.resize(config.particleN);
+		workspace.particleAccelerationTmp.resize(config.particleN);
+		workspace.cellLevel.resize(cellRecords.size());
+		workspace.activeCells.resize(cellRecords.size());
+		workspace.densityCells.resize(cellRecords.size());
+	}
 }
 
 void SPHcpu::reset() {
-	for(unsigned i = 0; i < particlePos.size(); ++i) {
-		particlePos[i] = b.min + (b.max-b.min)*vec3(frand(), frand(), frand());
-		particleVel[i] = normalize(vec3(rand(), rand(), rand()));
-	}
+	InitialState(config, b).generate([this](unsigned i, const vec3& pos, const vec3& vel) {
+		particlePos[i] = pos;
+		particleVel[i] = vel;
+	});
+	iota(particleID.begin(), particleID.end(), 0);
+	cellRecordsValid = false;
+	fineStep = 0;
+	savedParticleUpdates = 0;
 	bufferData(particlePositionBuff, particlePos, GL_DYNAMIC_DRAW);
 }
 
 void SPHcpu::update() {
 	updateCellRecords();
-	// calculate density and presure at each particle position
-	vector<float> density(particlePos.size(), config.M);
-	vector<float> pressure(particlePos.size(), 0);
-	for(unsigned i = 0; i < particlePos.size(); ++i) {
-		vector<unsigned> neighbourCells = nnCells(particlePos[i]);
-		for(unsigned cellID : neighbourCells) {
-			CellRecord r = cellRecords[cellID];
-			for(unsigned j = r.firstParticleID; j < r.firstParticleID+r.particleN; ++j) {
-				density[i] += config.M*w(particlePos[i]-particlePos[j], config.H);
+	if(config.Solver == PressureSolver::PCISPH) {
+		computeDensities(particlePos, workspace.density);
+		updatePcisph();
+	}
+	else if(config.LocalTimeStepping) {
+		savedParticleUpdates += config.particleN - selectActiveCells();
+		computeDensities(particlePos, workspace.density, &workspace.densityCells);
+		updateWcsph(&workspace.activeCells);
+		++fineStep;
+	}
+	else {
+		computeDensities(particlePos, workspace.density);
+		updateWcsph();
+	}
+	if(collectHealth)
+		computeHealth();
+	swap(particlePos, particlePosTmp);
+	auto collideBegin = std::chrono::steady_clock::now();
+	collide();
+	collisionTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - collideBegin).count();
+
+	bufferSubData(particlePositionBuff, particlePos);
+}
+
+void SPHcpu::computeDensities(const std::vector<vec3>& pos, std::vector<float>& density, const std::vector<unsigned char>* cellMask) {
+	if(config.TiledTraversal) {
+		// the particles of a cell are contiguous, the predicted positions of PCISPH use the tile of their current cell
+		const vector<vec3>& tilePos = workspace.tilePos;
+		for(unsigned c = 0; c < cellRecords.size(); ++c) {
+			const CellRecord& r = cellRecords[c];
+			if(r.particleN == 0 || (cellMask && !(*cellMask)[c]))
+				continue;
+			unsigned tileN = gatherTile(c, pos, false);
+			for(unsigned i = r.firstParticleID; i < r.firstParticleID+r.particleN; ++i) {
+				float d = config.M;
+				for(unsigned k = 0; k < tileN; ++k)
+					addWcsphDensity(config, pos[i]-tilePos[k], d);
+				density[i] = d;
 			}
 		}
-		pressure[i] = config.K*(density[i]-config.Rho0);
+		return;
+	}
+	unsigned neighbourCells[27];
+	for(unsigned i = 0; i < pos.size(); ++i) {
+		if(cellMask && !(*cellMask)[particleRecords[i].cellID])
+			continue;
+		density[i] = config.M;
+		unsigned neighbourCellN = nnCells(pos[i], neighbourCells);
+		for(unsigned n = 0; n < neighbourCellN; ++n) {
+			CellRecord r = cellRecords[neighbourCells[n]];
+			for(unsigned j = r.firstParticleID; j < r.firstParticleID+r.particleN; ++j)
+				addWcsphDensity(config, pos[i]-pos[j], density[i]);
+		}
 		assert(density[i] != 0);
 	}
+}
+
+void SPHcpu::updateWcsph(const std::vector<unsigned char>* activeCells) {
+	vector<float>& density = workspace.density;
+	vector<float>& pressure = workspace.pressure;
+	unsigned neighbourCells[27];
+	for(unsigned i = 0; i < particlePos.size(); ++i)
+		pressure[i] = wcsphPressure(config, density[i]);
+	if(config.TiledTraversal) {
+		// the tiles hold the velocities from the start of the step, the new ones go to particleVelTmp
+		vector<vec3>& particleVelTmp = workspace.particleVelTmp;
+		const vector<vec3>& tilePos = workspace.tilePos;
+		const vector<vec3>& tileVel = workspace.tileVel;
+		const vector<float>& tileDensity = workspace.tileDensity;
+		const vector<float>& tilePressure = workspace.tilePressure;
+		for(unsigned c = 0; c < cellRecords.size(); ++c) {
+			const CellRecord& r = cellRecords[c];
+			if(r.particleN == 0)
+				continue;
+			bool active = !activeCells || (*activeCells)[c];
+			unsigned tileN = active ? gatherTile(c, particlePos, true) : 0;
+			for(unsigned i = r.firstParticleID; i < r.firstParticleID+r.particleN; ++i) {
+				particlePosTmp[i] = particlePos[i] + particleVel[i]*config.Step;
+				if(!active) {
+					particleVelTmp[i] = particleVel[i] + particleAcceleration[i]*config.Step;
+					continue;
+				}
+				vec3 fPressure = {};
+				vec3 fViscosity = {};
+				for(unsigned k = 0; k < tileN; ++k)
+					addWcsphForces(config, particlePos[i]-tilePos[k], pressure[i], tilePressure[k], tileDensity[k], particleVel[i], tileVel[k], fPressure, fViscosity);
+				vec3 a = wcsphAcceleration(fPressure, fViscosity, density[i]);
+				particleVelTmp[i] = particleVel[i] + a*config.Step;
+				if(activeCells)
+					particleAcceleration[i] = a;
+			}
+		}
+		swap(particleVel, particleVelTmp);
+		return;
+	}
 	// calculate forces acting upon its particle, its acceleration; update its position and speed
 	for(unsigned i = 0; i < particlePos.size(); ++i) {
+		if(activeCells && !(*activeCells)[particleRecords[i].cellID]) {
+			// a calm cell: the acceleration from its last update still holds
+			particlePosTmp[i] = particlePos[i] + particleVel[i]*config.Step;
+			particleVel[i] += particleAcceleration[i]*config.Step;
+			continue;
+		}
 		vec3 fPressure = {};
 		vec3 fViscosity = {};
-		vector<unsigned> neighbourCells = nnCells(particlePos[i]);
-		for(unsigned cellID : neighbourCells) {
-			CellRecord r = cellRecords[cellID];
-			for(unsigned j = r.firstParticleID; j < r.firstParticleID+r.particleN; ++j) {
-				vec3 fp = config.M*(pressure[i]+pressure[j])/(2*density[j])*wPresure1(particlePos[i]-particlePos[j], config.H);
-				vec3 fv = (particleVel[j]-particleVel[i])*float(config.Mu*config.M/density[j]*wViscosity2(particlePos[i]-particlePos[j], config.H));
-				assert(!isnan(length(fp)));
-				assert(!isnan(length(fv)));
-				fPressure += fp;
-				fViscosity += fv;
-			}
+		unsigned neighbourCellN = nnCells(particlePos[i], neighbourCells);
+		for(unsigned n = 0; n < neighbourCellN; ++n) {
+			CellRecord r = cellRecords[neighbourCells[n]];
+			for(unsigned j = r.firstParticleID; j < r.firstParticleID+r.particleN; ++j)
+				addWcsphForces(config, particlePos[i]-particlePos[j], pressure[i], pressure[j], density[j], particleVel[i], particleVel[j], fPressure, fViscosity);
 		}
-		vec3 fGravity = -UP*9.81f*density[i];
-		vec3 f = fViscosity + fPressure + fGravity;
-		vec3 a = f/density[i];
-		assert(length(a) >= 0);
-		assert(length(f) >= 0);
+		vec3 a = wcsphAcceleration(fPressure, fViscosity, density[i]);
+		assert(!isnan(length(a)));
+		if(activeCells)
+			particleAcceleration[i] = a;
 		// update position using the current speed
 		particlePosTmp[i] = particlePos[i] + particleVel[i]*config.Step;
 		// update speed using the computed acceleration
 		particleVel[i] += a*config.Step;
 	}
-	swap(particlePos, particlePosTmp);
-	collide();
+}
 
-	bufferData(particlePositionBuff, particlePos, GL_DYNAMIC_DRAW);
+void SPHcpu::updatePcisph() {
+	const vector<float>& density = workspace.density;
+	vector<float>& pressure = workspace.pressure;
+	vector<vec3>& accelerationNp = workspace.accelerationNp;
+	vector<vec3>& accelerationP = workspace.accelerationP;
+	vector<vec3>& predictedPos = workspace.predictedPos;
+	vector<float>& predictedDensity = workspace.predictedDensity;
+	unsigned neighbourCells[27];
+	// non-pressure accelerations (viscosity, gravity) stay fixed during the iterations
+	for(unsigned i = 0; i < particlePos.size(); ++i) {
+		vec3 fViscosity = {};
+		unsigned neighbourCellN = nnCells(particlePos[i], neighbourCells);
+		for(unsigned n = 0; n < neighbourCellN; ++n) {
+			CellRecord r = cellRecords[neighbourCells[n]];
+			for(unsigned j = r.firstParticleID; j < r.firstParticleID+r.particleN; ++j)
+				fViscosity += (particleVel[j]-particleVel[i])*float(config.Mu*config.M/density[j]*wViscosity2(particlePos[i]-particlePos[j], config.H));
+		}
+		accelerationNp[i] = fViscosity/density[i] - UP*9.81f;
+		accelerationP[i] = {};
+		pressure[i] = 0;
+	}
+	float delta = pcisphDelta(config);
+	for(pressureIterations = 0; pressureIterations < config.MaxPressureIterations; ) {
+		// density at the positions predicted with the current pressure
+		for(unsigned i = 0; i < particlePos.size(); ++i)
+			predictedPos[i] = particlePos[i] + (particleVel[i] + (accelerationNp[i]+accelerationP[i])*config.Step)*config.Step;
+		computeDensities(predictedPos, predictedDensity);
+		// correct the pressure by the compression, no tension at the free surface
+		float maxError = 0;
+		for(unsigned i = 0; i < particlePos.size(); ++i) {
+			float e = predictedDensity[i]-config.Rho0;
+			pressure[i] = std::max(0.f, pressure[i] + delta*e);
+			maxError = std::max(maxError, e/config.Rho0);
+		}
+		for(unsigned i = 0; i < particlePos.size(); ++i) {
+			vec3 fPressure = {};
+			unsigned neighbourCellN = nnCells(particlePos[i], neighbourCells);
+			for(unsigned n = 0; n < neighbourCellN; ++n) {
+				CellRecord r = cellRecords[neighbourCells[n]];
+				for(unsigned j = r.firstParticleID; j < r.firstParticleID+r.particleN; ++j)
+					fPressure += config.M*(pressure[i]+pressure[j])/(2*density[j])*wPresure1(particlePos[i]-particlePos[j], config.H);
+			}
+			accelerationP[i] = fPressure/density[i];
+		}
+		++pressureIterations;
+		if(pressureIterations >= config.MinPressureIterations && maxError < config.DensityTolerance)
+			break;
+	}
+	// semi-implicit Euler, the same as in the prediction
+	for(unsigned i = 0; i < particlePos.size(); ++i) {
+		particleVel[i] += (accelerationNp[i]+accelerationP[i])*config.Step;
+		particlePosTmp[i] = particlePos[i] + particleVel[i]*config.Step;
+	}
+}
+
+void SPHcpu::getParticles(std::vector<vec3>& pos, std::vector<vec3>& vel) {
+	pos = particlePos;
+	vel = particleVel;
+}
+
+void SPHcpu::setParticles(const std::vector<vec3>& pos, const std::vector<vec3>& vel) {
+	particlePos = pos;
+	particleVel = vel;
+	iota(particleID.begin(), particleID.end(), 0);
+	cellRecordsValid = false;
+	fineStep = 0;
+	bufferSubData(particlePositionBuff, particlePos);
+}
+
+void SPHcpu::getParticleIDs(std::vector<unsigned>& id) {
+	id = particleID;
+}
+
+void SPHcpu::getDensities(std::vector<float>& density) {
+	density = workspace.density;
+}
+
+void SPHcpu::getCellRecords(std::vector<CellRecord>& cellRecords) {
+	cellRecords = this->cellRecords;
 }
 
 void SPHcpu::collide() {
@@ -86,6 +282,9 @@ void SPHcpu::collide() {
 
 unsigned SPHcpu::particlePosToCellID(const vec3& particlePos) {
 	vec3 c = (particlePos - b.min) / (b.max - b.min) * float(config.SubdivisionN);
+	// an unstable run may throw the particles out of the bounds (or make them NaN), they must stay in the grid
+	for(int a = 0; a < 3; ++a)
+		c[a] = c[a] >= 0 ? std::min(c[a], float(config.SubdivisionN-1)) : 0;
 	return cellPosToID(c);
 }
 
@@ -93,27 +292,154 @@ unsigned SPHcpu::cellPosToID(const vec3& c) {
 	return unsigned(c.x)*config.SubdivisionN*config.SubdivisionN + unsigned(c.y)*config.SubdivisionN + unsigned(c.z);
 }
 
-vector<unsigned> SPHcpu::nnCells(const vec3& particlePos) {
+unsigned SPHcpu::nnCells(const vec3& particlePos, unsigned (&neighbourCells)[27]) {
 	using std::max;
 	using std::min;
-	vector<unsigned> r;
-	r.reserve(3*3*3);
 	vec3 c = ((particlePos - b.min) / (b.max - b.min)) * float(config.SubdivisionN);
 	int cx = c.x;
 	int cy = c.y;
 	int cz = c.z;
 	const int maxC = int(config.SubdivisionN)-1;
+	unsigned neighbourCellN = 0;
 	for(int x = max(0, cx-1); x <= min(maxC, cx+1); ++x) {
 		for(int y = max(0, cy-1); y <= min(maxC, cy+1); ++y) {
 			for(int z = max(0, cz-1); z <= min(maxC, cz+1); ++z) {
-				r.push_back(cellPosToID(vec3(x,y,z)));
+				neighbourCells[neighbourCellN++] = cellPosToID(vec3(x,y,z));
 			}
 		}
 	}
-	return r;
+	return neighbourCellN;
+}
+
+void SPHcpu::computeHealth() {
+	HealthMetrics& m = health;
+	m = {};
+	for(const CellRecord& r : cellRecords) {
+		++m.occupancy[occupancyBin(r.particleN)];
+		m.maxOccupancy = std::max(m.maxOccupancy, r.particleN);
+	}
+	unsigned neighbourCells[27];
+	for(unsigned i = 0; i < particlePos.size(); ++i) {
+		unsigned neighbourCellN = nnCells(particlePos[i], neighbourCells);
+		for(unsigned n = 0; n < neighbourCellN; ++n) {
+			CellRecord r = cellRecords[neighbourCells[n]];
+			m.candidates += r.particleN;
+			for(unsigned j = r.firstParticleID; j < r.firstParticleID+r.particleN; ++j)
+				if(length(particlePos[i]-particlePos[j]) < config.H)
+					++m.inRange;
+		}
+	}
+	const vector<float>& density = workspace.density;
+	double errorSum = 0, errorSqSum = 0;
+	m.minDensity = numeric_limits<float>::max();
+	m.maxDensity = numeric_limits<float>::lowest();
+	for(float d : density) {
+		float e = fabs(d-config.Rho0)/config.Rho0;
+		errorSum += e;
+		errorSqSum += double(e)*e;
+		m.maxDensityError = std::max(m.maxDensityError, e);
+		m.minDensity = std::min(m.minDensity, d);
+		m.maxDensity = std::max(m.maxDensity, d);
+	}
+	m.meanDensityError = errorSum/density.size();
+	m.rmsDensityError = sqrt(errorSqSum/density.size());
+}
+
+unsigned SPHcpu::gatherTile(unsigned cellID, const std::vector<vec3>& pos, bool forces) {
+	const int n = config.SubdivisionN;
+	const int cx = cellID/(n*n);
+	const int cy = cellID/n%n;
+	const int cz = cellID%n;
+	unsigned tileN = 0;
+	for(int x = std::max(0, cx-1); x <= std::min(n-1, cx+1); ++x) {
+		for(int y = std::max(0, cy-1); y <= std::min(n-1, cy+1); ++y) {
+			// the neighbour cells along z are adjacent in the particle order - a single run
+			unsigned first = cellRecords[cellPosToID(vec3(x, y, std::max(0, cz-1)))].firstParticleID;
+			const CellRecord& last = cellRecords[cellPosToID(vec3(x, y, std::min(n-1, cz+1)))];
+			unsigned end = last.firstParticleID + last.particleN;
+			std::copy(pos.begin()+first, pos.begin()+end, workspace.tilePos.begin()+tileN);
+			if(forces) {
+				std::copy(particleVel.begin()+first, particleVel.begin()+end, workspace.tileVel.begin()+tileN);
+				std::copy(workspace.density.begin()+first, workspace.density.begin()+end, workspace.tileDensity.begin()+tileN);
+				std::copy(workspace.pressure.begin()+first, workspace.pressure.begin()+end, workspace.tilePressure.begin()+tileN);
+			}
+			tileN += end-first;
+		}
+	}
+	return tileN;
+}
+
+void limitLevelJumps(vector<unsigned char>& cellLevel, int n) {
+	// a single in-place sweep only carries the limit forward (3,3,3,0 becomes 3,3,1,0),
+	// each pass lowers the levels by at least one more step until they hold
+	bool changed = true;
+	while(changed) {
+		changed = false;
+		for(int x = 0; x < n; ++x)
+			for(int y = 0; y < n; ++y)
+				for(int z = 0; z < n; ++z) {
+					unsigned char& level = cellLevel[(x*n + y)*n + z];
+					for(int nx = std::max(0, x-1); nx <= std::min(n-1, x+1); ++nx)
+						for(int ny = std::max(0, y-1); ny <= std::min(n-1, y+1); ++ny)
+							for(int nz = std::max(0, z-1); nz <= std::min(n-1, z+1); ++nz) {
+								unsigned char limit = cellLevel[(nx*n + ny)*n + nz] + 1;
+								if(level > limit) {
+									level = limit;
+									changed = true;
+								}
+							}
+				}
+	}
+}
+
+unsigned SPHcpu::selectActiveCells() {
+	vector<unsigned char>& cellLevel = workspace.cellLevel;
+	vector<unsigned char>& activeCells = workspace.activeCells;
+	vector<unsigned char>& densityCells = workspace.densityCells;
+	const int n = config.SubdivisionN;
+	const unsigned maxLevel = config.MaxTimeStepLevel;
+	// the level allowed by the fastest particle of the cell (empty cells do not constrain their neighbours)
+	for(unsigned c = 0; c < cellRecords.size(); ++c) {
+		const CellRecord& r = cellRecords[c];
+		float maxSpeed = 0;
+		float maxAcceleration = 0;
+		for(unsigned i = r.firstParticleID; i < r.firstParticleID+r.particleN; ++i) {
+			maxSpeed = std::max(maxSpeed, length(particleVel[i]));
+			maxAcceleration = std::max(maxAcceleration, length(particleAcceleration[i]));
+		}
+		float allowedStep = config.TimeStepCfl*std::min(maxSpeed > 0 ? config.H/maxSpeed : numeric_limits<float>::max(),
+				maxAcceleration > 0 ? sqrt(config.H/maxAcceleration) : numeric_limits<float>::max());
+		float level = std::floor(std::log2(allowedStep/config.Step));
+		// NaN of an unstable run ends at the level 0
+		cellLevel[c] = level >= 0 ? std::min(unsigned(std::min(level, 32.f)), maxLevel) : 0;
+	}
+	limitLevelJumps(cellLevel, n);
+	// the cells of the level l synchronise with the finer levels every 2^l steps
+	unsigned activeN = 0;
+	for(unsigned c = 0; c < cellRecords.size(); ++c) {
+		activeCells[c] = fineStep % (1u << cellLevel[c]) == 0;
+		densityCells[c] = 0;
+		if(activeCells[c])
+			activeN += cellRecords[c].particleN;
+	}
+	// the forces of the active cells need the densities of the neighbours
+	for(int x = 0; x < n; ++x)
+		for(int y = 0; y < n; ++y)
+			for(int z = 0; z < n; ++z) {
+				if(!activeCells[cellPosToID(vec3(x,y,z))])
+					continue;
+				for(int nx = std::max(0, x-1); nx <= std::min(n-1, x+1); ++nx)
+					for(int ny = std::max(0, y-1); ny <= std::min(n-1, y+1); ++ny)
+						for(int nz = std::max(0, z-1); nz <= std::min(n-1, z+1); ++nz)
+							densityCells[cellPosToID(vec3(nx,ny,nz))] = 1;
+			}
+	return activeN;
 }
 
 void SPHcpu::updateCellRecords() {
+	fullRebuild = !(config.IncrementalRebinning && cellRecordsValid && rebinIncrementally());
+	if(!fullRebuild)
+		return;
 	for(CellRecord& r : cellRecords)
 		r.particleN = 0;
 	// for each particle: calculate cell coordinates -> hash
@@ -124,15 +450,11 @@ void SPHcpu::updateCellRecords() {
 	// sort particleRecords by cell_id (this will form clusters for each cell)
 	std::sort(particleRecords.begin(), particleRecords.end(), [](ParticleRecord& l, ParticleRecord& r){ return l.cellID < r.cellID; });
 	// for each cell_id_hash create cell_rec (first_particle_rec, particle_rec_n)
-	// reorder particle array according to particle_rec
 	unsigned cellID = particleRecords[0].cellID;
 	unsigned cellParticleN = 0;
 	cellRecords[cellID].firstParticleID = 0;
-	vector<vec3> particleVelTmp(config.particleN);
 	for(unsigned i = 0; i < config.particleN; ++i) {
 		ParticleRecord& r = particleRecords[i];
-		particlePosTmp[i] = particlePos[r.particleID];
-		particleVelTmp[i] = particleVel[r.particleID];
 		if(r.cellID != cellID) {
 			cellRecords[r.cellID].firstParticleID = i;
 			cellRecords[cellID].particleN = cellParticleN;
@@ -142,6 +464,86 @@ void SPHcpu::updateCellRecords() {
 		++cellParticleN;
 	}
 	cellRecords[cellID].particleN = cellParticleN;
+	// the empty cells get their position in the order as well (the tiles take the runs of adjacent cells)
+	unsigned firstParticleID = 0;
+	for(CellRecord& c : cellRecords) {
+		c.firstParticleID = firstParticleID;
+		firstParticleID += c.particleN;
+	}
+	// reorder particle array according to particle_rec
+	reorderParticles();
+	cellRecordsValid = true;
+}
+
+bool SPHcpu::rebinIncrementally() {
+	const unsigned moved = numeric_limits<unsigned>::max();
+	// the particles are ordered by the cells from the last step - particleRecords[i].cellID is the previous cell of particle i
+	vector<ParticleRecord>& changedRecords = workspace.changedRecords;
+	vector<ParticleRecord>& particleRecordsTmp = workspace.particleRecordsTmp;
+	changedRecords.clear();
+	for(unsigned i = 0; i < config.particleN; ++i) {
+		ParticleRecord& r = particleRecords[i];
+		unsigned cellID = particlePosToCellID(particlePos[i]);
+		r.particleID = i;
+		if(cellID != r.cellID) {
+			// only the cells which lost or gained a particle change their particle count
+			--cellRecords[r.cellID].particleN;
+			++cellRecords[cellID].particleN;
+			changedRecords.push_back({cellID, i});
+			r.cellID = moved;
+		}
+	}
+	rebinnedFraction = float(changedRecords.size())/config.particleN;
+	if(rebinnedFraction > config.RebinThreshold)
+		return false;
+	if(changedRecords.empty())
+		return true;
+
+	// merge the unchanged records (still sorted) with the small sorted set of the changed ones
+	std::sort(changedRecords.begin(), changedRecords.end(), [](const ParticleRecord& l, const ParticleRecord& r){ return l.cellID < r.cellID; });
+	auto changed = changedRecords.begin();
+	unsigned out = 0;
+	for(const ParticleRecord& r : particleRecords) {
+		if(r.cellID == moved)
+			continue;
+		while(changed != changedRecords.end() && changed->cellID < r.cellID)
+			particleRecordsTmp[out++] = *changed++;
+		particleRecordsTmp[out++] = r;
+	}
+	while(changed != changedRecords.end())
+		particleRecordsTmp[out++] = *changed++;
+	swap(particleRecords, particleRecordsTmp);
+
+	unsigned firstParticleID = 0;
+	for(CellRecord& c : cellRecords) {
+		c.firstParticleID = firstParticleID;
+		firstParticleID += c.particleN;
+	}
+	reorderParticles();
+	return true;
+}
+
+void SPHcpu::reorderParticles() {
+	vector<vec3>& particleVelTmp = workspace.particleVelTmp;
+	vector<unsigned>& particleIDTmp = workspace.particleIDTmp;
+	for(unsigned i = 0; i < config.particleN; ++i) {
+		const ParticleRecord& r = particleRecords[i];
+		particlePosTmp[i] = particlePos[r.particleID];
+		particleVelTmp[i] = particleVel[r.particleID];
+		particleIDTmp[i] = particleID[r.particleID];
+	}
 	swap(particlePos, particlePosTmp);
 	swap(particleVel, particleVelTmp);
+	swap(particleID, particleIDTmp);
+	if(config.LocalTimeStepping) {
+		// the state reused by the calm cells moves with the particles
+		vector<float>& densityTmp = workspace.densityTmp;
+		vector<vec3>& particleAccelerationTmp = workspace.particleAccelerationTmp;
+		for(unsigned i = 0; i < config.particleN; ++i) {
+			densityTmp[i] = workspace.density[particleRecords[i].particleID];
+			particleAccelerationTmp[i] = particleAcceleration[particleRecords[i].particleID];
+		}
+		swap(workspace.density, densityTmp);
+		swap(particleAcceleration, particleAccelerationTmp);
+	}
 }
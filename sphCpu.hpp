@@ -10,25 +10,85 @@
 #define SPHCPU_HPP_20_01_07_21_10_15 
 #include "sph.hpp"
 
+/// lowers the time-step levels of the cells (linear IDs as SPHcpu::cellPosToID, n cells along each axis)
+/// until the neighbouring cells differ at most by one level
+void limitLevelJumps(std::vector<unsigned char>& cellLevel, int n);
+
 /// CPU implementation of SPH
 class SPHcpu: public SPH {
 	public:
 		SPHcpu(SPHconfig &config, Bounds& _b);
 		void reset() override;
 		void update() override;
+		void getParticles(std::vector<vec3>& pos, std::vector<vec3>& vel) override;
+		void setParticles(const std::vector<vec3>& pos, const std::vector<vec3>& vel) override;
+		void getParticleIDs(std::vector<unsigned>& id) override;
+		void getDensities(std::vector<float>& density) override;
+		void getCellRecords(std::vector<CellRecord>& cellRecords) override;
 		void collide();
+		/// density at the positions pos (the same particle order as particlePos) using the current grid
+		/// \param cellMask if set, only the particles of the cells with a non-zero mask are computed
+		void computeDensities(const std::vector<vec3>& pos, std::vector<float>& density, const std::vector<unsigned char>* cellMask = nullptr);
+		/// forces from the equation of state, explicit integration into particlePosTmp and particleVel
+		/// \param activeCells if set, the forces are evaluated only in the cells with a non-zero mask, the other particles reuse particleAcceleration
+		void updateWcsph(const std::vector<unsigned char>* activeCells = nullptr);
+		/// fills health from the grid and the densities of this step
+		void computeHealth();
+		/// local time stepping: assigns the time-step level of the cells and marks the cells whose forces are evaluated in this step
+		/// \return number of particles whose forces are evaluated
+		unsigned selectActiveCells();
+		/// pressure iterated until the predicted compression is small, integration into particlePosTmp and particleVel
+		void updatePcisph();
 		unsigned particlePosToCellID(const vec3& particlePos);
 		unsigned cellPosToID(const vec3& c);
-		std::vector<unsigned> nnCells(const vec3& particlePos);
+		/// \return number of neighbour cells written to neighbourCells
+		unsigned nnCells(const vec3& particlePos, unsigned (&neighbourCells)[27]);
+		/// tiled traversal: copies the particles of the cells around cellID into the tile (the pressure only if forces)
+		/// \return number of the particles in the tile
+		unsigned gatherTile(unsigned cellID, const std::vector<vec3>& pos, bool forces);
 		void updateCellRecords();
+		/// moves only the particles which changed their cell, falls back to the full rebuild above config.RebinThreshold
+		/// \return false if the full rebuild is needed
+		bool rebinIncrementally();
+		/// reorders particle position and velocity according to particleRecords
+		void reorderParticles();
 
 	private:
+		/// Per-step temporaries. Sized once, so that the steady-state step does not allocate.
+		/// The step runs on a single thread, a multithreaded step needs one workspace per thread.
+		struct Workspace {
+			std::vector<float> density;
+			std::vector<float> pressure;
+			std::vector<vec3> particleVelTmp;
+			std::vector<unsigned> particleIDTmp;
+			std::vector<ParticleRecord> particleRecordsTmp;
+			std::vector<ParticleRecord> changedRecords; /// particles which changed their cell (incremental rebinning)
+			std::vector<vec3> accelerationNp; /// PCISPH: non-pressure acceleration
+			std::vector<vec3> accelerationP; /// PCISPH: pressure acceleration
+			std::vector<vec3> predictedPos; /// PCISPH
+			std::vector<float> predictedDensity; /// PCISPH
+			std::vector<float> densityTmp; /// local time stepping: the densities are kept between the steps and reordered with the particles
+			std::vector<vec3> particleAccelerationTmp; /// local time stepping
+			std::vector<unsigned char> cellLevel; /// local time stepping: the cell is updated every 2^level steps
+			std::vector<unsigned char> activeCells; /// local time stepping: forces evaluated in this step
+			std::vector<unsigned char> densityCells; /// local time stepping: the active cells and their neighbours
+			std::vector<vec3> tilePos; /// tiled traversal: neighbours of the current cell, contiguous
+			std::vector<vec3> tileVel;
+			std::vector<float> tileDensity;
+			std::vector<float> tilePressure;
+		};
+
 		std::vector<vec3> particlePos;
 		std::vector<vec3> particleVel;
 		std::vector<vec3> particlePosTmp;
+		std::vector<unsigned> particleID; /// index of the particle in the last reset or setParticles
+		std::vector<vec3> particleAcceleration; /// local time stepping: the last evaluated acceleration, reused until the next update of the cell
+		unsigned fineStep; /// local time stepping: steps since the reset, a cell of the level l is updated when fineStep is a multiple of 2^l
 
 		std::vector<CellRecord> cellRecords;
 		std::vector<ParticleRecord> particleRecords;
+		Workspace workspace;
+		bool cellRecordsValid; /// particleRecords and cellRecords correspond to the current particle order
 };
 
 #endif /* SPHCPU_HPP_20_01_07_21_10_15 */
@@ -0,0 +1,185 @@
+#include "initialState.hpp"
+#include "sphEnsemble.hpp"
+using namespace std;
+
+SPHensemble::SPHensemble(const std::vector<SPHconfig>& _configs, const std::vector<Bounds>& _bounds): configs{_configs}, bounds{_bounds},
+	updateStage{"shaders/SPHupdate.comp", 0},
+	densityStage{"shaders/SPHdensity.comp", 0},
+	particleRecStage{"shaders/ParticleRec.comp", 0},
+	sortParticleRecStage{"shaders/SortParticleRec.comp", 0},
+	cellRecStage{"shaders/CellRec.comp", 0},
+	particleReorderStage{"shaders/ParticleReorder.comp", 0}
+{
+	totalParticleN = 0;
+	cellN = 0;
+	for(unsigned s = 0; s < configs.size(); ++s) {
+		const SPHconfig& c = configs[s];
+		const Bounds& b = bounds[s];
+		if(b.obstacles)
+			cerr << "Obstacles are not supported by the ensemble, ignored\n";
+		if(c.Solver != PressureSolver::WCSPH)
+			cerr << "The ensemble supports only the WCSPH solver, used instead\n";
+		if(c.LocalTimeStepping)
+			cerr << "Local time stepping is not supported by the ensemble, ignored\n";
+		members.push_back({b.min, c.Step, b.max, c.H, c.M, c.Rho0, c.K, c.Mu, c.SubdivisionN, cellN, totalParticleN, c.particleN});
+		totalParticleN += c.particleN;
+		cellN += c.SubdivisionN*c.SubdivisionN*c.SubdivisionN;
+	}
+	paddedParticleN = 1;
+	while(paddedParticleN < totalParticleN)
+		paddedParticleN *= 2;
+
+	vector<Stage*> stages = {&updateStage, &densityStage, &particleRecStage, &sortParticleRecStage, &cellRecStage, &particleReorderStage};
+	vector<ShaderProgramSource> sources;
+	for(Stage* s : stages)
+		sources.push_back({{make_tuple(GL_COMPUTE_SHADER, s->file)}, {"LOCAL_SIZE " + to_string(localSize), "ENSEMBLE"}});
+	vector<GLuint> programs = loadShaderPrograms(sources);
+	for(unsigned i = 0; i < programs.size(); ++i) {
+		if(!programs[i])
+			cerr << "Failed to load compute shader program " << stages[i]->file << endl;
+		stages[i]->program = programs[i];
+	}
+
+	vector<GLuint> particleMember(paddedParticleN, 0);
+	for(unsigned s = 0; s < members.size(); ++s)
+		fill(particleMember.begin()+members[s].firstParticle, particleMember.begin()+members[s].firstParticle+members[s].particleN, s);
+
+	glGenBuffers(1, &particlePositionBuff);
+	glGenBuffers(1, &particlePositionBuffOut);
+	glGenBuffers(1, &particleVelocityBuff);
+	glGenBuffers(1, &particleVelocityBuffOut);
+	glGenBuffers(1, &densityBuff);
+	glGenBuffers(1, &particleRecBuffer);
+	glGenBuffers(1, &cellRecBuffer);
+	glGenBuffers(1, &memberBuffer);
+	glGenBuffers(1, &particleMemberBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, particlePositionBuffOut);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, paddedParticleN*sizeof(vec4), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleVelocityBuffOut);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, paddedParticleN*sizeof(vec4), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, densityBuff);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, paddedParticleN*sizeof(float), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleRecBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, paddedParticleN*sizeof(ParticleRecord), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, cellRecBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, cellN*sizeof(CellRecord), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, memberBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, members.size()*sizeof(Member), members.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleMemberBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, particleMember.size()*sizeof(GLuint), particleMember.data(), GL_STATIC_DRAW);
+	reset();
+}
+
+void SPHensemble::reset() {
+	vector<vec4> particlePos(paddedParticleN, vec4(0,0,0,0));
+	vector<vec4> particleVel(paddedParticleN, vec4(0,0,0,0));
+	// the same particles as SPHgpu::reset() of the member alone
+	for(unsigned s = 0; s < members.size(); ++s) {
+		unsigned first = members[s].firstParticle;
+		InitialState(configs[s], bounds[s]).generate([&](unsigned i, const vec3& pos, const vec3& vel) {
+			particlePos[first+i] = vec4(pos, 0);
+			particleVel[first+i] = vec4(vel, 0);
+		});
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, particlePositionBuff);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, particlePos.size()*sizeof(vec4), particlePos.data(), GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleVelocityBuff);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, particleVel.size()*sizeof(vec4), particleVel.data(), GL_DYNAMIC_COPY);
+}
+
+void SPHensemble::update() {
+	// same bindings as SPHgpu, plus the member parameters
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, densityBuff);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, particlePositionBuff);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, particlePositionBuffOut);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, particleVelocityBuff);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, particleRecBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, cellRecBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, particleVelocityBuffOut);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, memberBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, particleMemberBuffer);
+
+	rebuildCellRecords();
+
+	// one invocation per particle of all the members, each loads the parameters of its member
+	for(Stage* s : {&densityStage, &updateStage}) {
+		glUseProgram(s->program);
+		glUniform1ui(glGetUniformLocation(s->program, "ensembleParticleN"), totalParticleN);
+		glDispatchCompute(groupN(paddedParticleN), 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+	swap(particlePositionBuff, particlePositionBuffOut);
+	swap(particleVelocityBuff, particleVelocityBuffOut);
+}
+
+void SPHensemble::rebuildCellRecords() {
+	glUseProgram(particleRecStage.program);
+	glUniform1ui(glGetUniformLocation(particleRecStage.program, "ensembleParticleN"), totalParticleN);
+	glDispatchCompute(groupN(paddedParticleN), 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	sortParticleRecords();
+
+	glUseProgram(cellRecStage.program);
+	glUniform1ui(glGetUniformLocation(cellRecStage.program, "pass"), 0);
+	glDispatchCompute(groupN(cellN), 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	glUniform1ui(glGetUniformLocation(cellRecStage.program, "pass"), 1);
+	glDispatchCompute(groupN(paddedParticleN), 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	reorderParticles();
+}
+
+void SPHensemble::sortParticleRecords() {
+	GLuint sortProgram = sortParticleRecStage.program;
+	glUseProgram(sortProgram);
+	for(size_t l = 2; l < 2*paddedParticleN; l *= 2) {
+		for(size_t seqLen = l; seqLen > 1; seqLen /= 2) {
+			glUniform1ui(glGetUniformLocation(sortProgram, "seqLen"), seqLen);
+			glUniform1ui(glGetUniformLocation(sortProgram, "blockLen"), l);
+			glDispatchCompute(groupN(paddedParticleN), 1, 1);
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		}
+	}
+}
+
+void SPHensemble::reorderParticles() {
+	// the padding records point to the padding particles, so the whole buffers can be reordered
+	glUseProgram(particleReorderStage.program);
+	glDispatchCompute(groupN(paddedParticleN), 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	swap(particlePositionBuff, particlePositionBuffOut);
+	swap(particleVelocityBuff, particleVelocityBuffOut);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, particlePositionBuff);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, particlePositionBuffOut);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, particleVelocityBuff);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, particleVelocityBuffOut);
+}
+
+unsigned SPHensemble::groupN(unsigned invocationN) {
+	return (invocationN + localSize-1)/localSize;
+}
+
+void SPHensemble::getParticles(unsigned member, std::vector<vec3>& pos, std::vector<vec3>& vel) {
+	pos = readVec3Buffer(particlePositionBuff, members[member].firstParticle, members[member].particleN);
+	vel = readVec3Buffer(particleVelocityBuff, members[member].firstParticle, members[member].particleN);
+}
+
+void SPHensemble::getDensities(unsigned member, std::vector<float>& density) {
+	density.resize(members[member].particleN);
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, densityBuff);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, members[member].firstParticle*sizeof(float), density.size()*sizeof(float), density.data());
+}
+
+vector<vec3> SPHensemble::readVec3Buffer(GLuint buffer, unsigned first, unsigned n) {
+	vector<vec4> data(n);
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, first*sizeof(vec4), n*sizeof(vec4), data.data());
+	vector<vec3> r(n);
+	for(unsigned i = 0; i < n; ++i)
+		r[i] = vec3(data[i].x, data[i].y, data[i].z);
+	return r;
+}
@@ -0,0 +1,89 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       sphEnsemble.hpp
+ * \author     Ales Koblizek
+ * \date       2026/10/19
+ * \brief      GPU ensemble of many small independent SPH simulations
+*/
+//----------------------------------------------------------------------------------------
+#ifndef SPHENSEMBLE_HPP_26_10_19_12_20_41
+#define SPHENSEMBLE_HPP_26_10_19_12_20_41 
+#include "sph.hpp"
+
+/* Many small independent simulations advanced by a single chain of dispatches (the ENSEMBLE variant of the SPHgpu shaders).
+ * The members share the buffers: member s owns a contiguous range of the particles and of the cells of the neighbour-search grid.
+ * The cell IDs are global, so sorting the particle records by the cell keeps the particles of each member together
+ * and the per-particle member index never changes.
+ * Not drawable, meant for the headless parameter studies.
+ */
+class SPHensemble {
+	public:
+		/// the members may differ in any parameter, bounds[s] belongs to configs[s]; obstacles and PCISPH are not supported
+		SPHensemble(const std::vector<SPHconfig>& configs, const std::vector<Bounds>& bounds);
+
+		void reset();
+		/// single step of all the members
+		void update();
+
+		unsigned memberN() const { return members.size(); }
+		/// particles of all the members together
+		unsigned particleN() const { return totalParticleN; }
+		/// state of a single member
+		void getParticles(unsigned member, std::vector<vec3>& pos, std::vector<vec3>& vel);
+		void getDensities(unsigned member, std::vector<float>& density);
+
+	private:
+		/// std430 layout of struct Simulation in the shaders
+		struct Member {
+			vec3 boundsMin;
+			float Step;
+			vec3 boundsMax;
+			float H;
+			float M;
+			float Rho0;
+			float K;
+			float Mu;
+			unsigned SubdivisionN;
+			unsigned firstCell;
+			unsigned firstParticle;
+			unsigned particleN;
+		};
+
+		struct Stage {
+			std::string file;
+			GLuint program;
+		};
+
+		void rebuildCellRecords();
+		void sortParticleRecords();
+		void reorderParticles();
+		unsigned groupN(unsigned invocationN);
+		/// reads a range of a vec4 buffer, drops the w component
+		std::vector<vec3> readVec3Buffer(GLuint buffer, unsigned first, unsigned n);
+
+	private:
+		std::vector<SPHconfig> configs;
+		std::vector<Bounds> bounds;
+		std::vector<Member> members;
+		unsigned totalParticleN;
+		unsigned paddedParticleN; /// power of two for the bitonic sort
+		unsigned cellN;
+		const unsigned localSize = 256;
+		GLuint particlePositionBuff;
+		GLuint particlePositionBuffOut;
+		GLuint particleVelocityBuff;
+		GLuint particleVelocityBuffOut;
+		GLuint densityBuff;
+		GLuint particleRecBuffer;
+		GLuint cellRecBuffer;
+		GLuint memberBuffer;
+		GLuint particleMemberBuffer; /// member index of each particle
+		Stage updateStage;
+		Stage densityStage;
+		Stage particleRecStage;
+		Stage sortParticleRecStage;
+		Stage cellRecStage;
+		Stage particleReorderStage;
+};
+
+#endif /* SPHENSEMBLE_HPP_26_10_19_12_20_41 */
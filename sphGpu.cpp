@@ -1,21 +1,70 @@
+#include <fstream>
+#include <sstream>
+#include <limits>
+#include <cstring>
+#include <numeric>
+#include "initialState.hpp"
 #include "sphGpu.hpp"
+#include "sphRegistry.hpp"
+#include "surface.hpp"
 using namespace std;
-const unsigned localGroupSize = 1024;
 
-SPHgpu::SPHgpu(SPHconfig &config, Bounds& _b): SPH{config, _b}, queryActive{false} {
+static SPHregistration registration("gpu", [](SPHconfig& config, Bounds& b) { return unique_ptr<SPH>(new SPHgpu(config, b)); });
+
+// buffer elements as the shaders access them, for movedBytes (vec3 has the stride of vec4 in std430)
+static const unsigned VecBytes = sizeof(vec4);
+static const unsigned FloatBytes = sizeof(float);
+static const unsigned RecordBytes = sizeof(ParticleRecord);
+
+SPHgpu::SPHgpu(SPHconfig &config, Bounds& _b): SPH{config, _b}, queryActive{false}, collisionQueryActive{false}, timedStage{nullptr}, timedStageTime{0}, cellRecordsValid{false}, stepsSinceReorder{0}, displacedFraction{0},
+	surfaceNodeCapacity{0}, surfaceVertexCapacity{0},
+	updateStage{"shaders/SPHupdate.comp", 1024, 0},
+	densityStage{"shaders/SPHdensity.comp", 1024, 0},
+	particleRecStage{"shaders/ParticleRec.comp", 1024, 0},
+	sortParticleRecStage{"shaders/SortParticleRec.comp", 1024, 0},
+	cellRecStage{"shaders/CellRec.comp", 1024, 0},
+	particleRebinStage{"shaders/ParticleRebin.comp", 1024, 0},
+	pcisphStage{"shaders/PCISPH.comp", 1024, 0},
+	healthStage{"shaders/Health.comp", 1024, 0},
+	surfaceStage{"shaders/Surface.comp", 1024, 0},
+	initStage{"shaders/Init.comp", 1024, 0}
+{
+	if(config.LocalTimeStepping)
+		cerr << "Local time stepping is not supported by the GPU backend, ignored\n";
 	glGenQueries(1, &queryID);
-	updateProgram = loadShaderProgram({make_tuple(GL_COMPUTE_SHADER, "shaders/SPHupdate.comp")});
-	densityProgram = loadShaderProgram({make_tuple(GL_COMPUTE_SHADER, "shaders/SPHdensity.comp")});
-	particleRecProgram = loadShaderProgram({make_tuple(GL_COMPUTE_SHADER, "shaders/ParticleRec.comp")});
-	sortParticleRecProgram = loadShaderProgram({make_tuple(GL_COMPUTE_SHADER, "shaders/SortParticleRec.comp")});
-	cellRecProgram = loadShaderProgram({make_tuple(GL_COMPUTE_SHADER, "shaders/CellRec.comp")});
-	particleReorderProgram = loadShaderProgram({make_tuple(GL_COMPUTE_SHADER, "shaders/ParticleReorder.comp")});
+	glGenQueries(1, &timedStageQueryID);
+	glGenQueries(2, collisionQueryIDs);
+	loadWorkgroupSizes();
+	loadPrograms();
 	glGenBuffers(1, &particlePositionBuffOut);
 	glGenBuffers(1, &particleVelocityBuff);
 	glGenBuffers(1, &particleVelocityBuffOut);
 	glGenBuffers(1, &densityBuff);
 	glGenBuffers(1, &particleRecBuffer);
 	glGenBuffers(1, &cellRecBuffer);
+	glGenBuffers(1, &particleRecBufferOut);
+	glGenBuffers(1, &changedByCellBuffer);
+	glGenBuffers(1, &changedByParticleBuffer);
+	glGenBuffers(1, &rebinCounterBuffer);
+	glGenBuffers(1, &pressureBuffer);
+	glGenBuffers(1, &accelerationNpBuffer);
+	glGenBuffers(1, &accelerationPBuffer);
+	glGenBuffers(1, &predictedPositionBuffer);
+	glGenBuffers(1, &predictedDensityBuffer);
+	glGenBuffers(1, &densityErrorBuffer);
+	glGenBuffers(1, &healthOccupancyBuffer);
+	glGenBuffers(1, &healthPartialBuffer);
+	glGenBuffers(1, &surfaceCellBuffer);
+	glGenBuffers(1, &surfaceNodeBuffer);
+	glGenBuffers(1, &marchingCubesBuffer);
+	glGenBuffers(1, &surfaceVertexBuffer);
+	glGenBuffers(1, &initialBlockBuffer);
+	glGenBuffers(1, &latticeNodeBuffer);
+	glGenBuffers(1, &particleIDBuffer);
+	glGenBuffers(1, &particleIDBufferOut);
+	obstacleTexture = 0;
+	if(b.obstacles)
+		uploadObstacles();
 	reset();
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, densityBuff);
 	glBufferData(GL_SHADER_STORAGE_BUFFER, config.particleN*sizeof(float), NULL, GL_DYNAMIC_COPY);
@@ -27,6 +76,37 @@ SPHgpu::SPHgpu(SPHconfig &config, Bounds& _b): SPH{config, _b}, queryActive{fals
 	glBufferData(GL_SHADER_STORAGE_BUFFER, config.SubdivisionN*config.SubdivisionN*config.SubdivisionN*sizeof(CellRecord), NULL, GL_DYNAMIC_COPY);
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleVelocityBuffOut);
 	glBufferData(GL_SHADER_STORAGE_BUFFER, config.particleN*sizeof(vec4), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleRecBufferOut);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, config.particleN*sizeof(ParticleRecord), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleIDBufferOut);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, config.particleN*sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, changedByCellBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, config.particleN*sizeof(ParticleRecord), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, changedByParticleBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, config.particleN*sizeof(ParticleRecord), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, rebinCounterBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), NULL, GL_DYNAMIC_READ);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, pressureBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, config.particleN*sizeof(float), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, accelerationNpBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, config.particleN*sizeof(vec4), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, accelerationPBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, config.particleN*sizeof(vec4), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, predictedPositionBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, config.particleN*sizeof(vec4), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, predictedDensityBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, config.particleN*sizeof(float), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, densityErrorBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), NULL, GL_DYNAMIC_READ);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, healthOccupancyBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, (HealthMetrics::OccupancyBinN+1)*sizeof(GLuint), NULL, GL_DYNAMIC_READ);
+	// one record of 8 words per workgroup, enough for the smallest workgroup size of the autotuning
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, healthPartialBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, (config.particleN/32+1)*8*sizeof(GLuint), NULL, GL_DYNAMIC_READ);
+	// 4 counters and 4 arrays of one word per cell, the node and vertex buffers are allocated by extractSurface
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, surfaceCellBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, (4 + 4*config.SubdivisionN*config.SubdivisionN*config.SubdivisionN)*sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+	bufferData(marchingCubesBuffer, marchingCubesTable(), GL_STATIC_DRAW);
 
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, densityBuff);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, particlePositionBuff);
@@ -35,20 +115,285 @@ SPHgpu::SPHgpu(SPHconfig &config, Bounds& _b): SPH{config, _b}, queryActive{fals
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, particleRecBuffer);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, cellRecBuffer);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, particleVelocityBuffOut);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, changedByCellBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, changedByParticleBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, rebinCounterBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, particleRecBufferOut);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 13, pressureBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 14, accelerationNpBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 15, accelerationPBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 16, predictedPositionBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 17, predictedDensityBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 18, densityErrorBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 19, healthOccupancyBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 20, healthPartialBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 21, surfaceCellBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 23, marchingCubesBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 27, particleIDBufferOut);
 
 	setParticlePositionAttrBuffer(4);
 	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	if(config.AutotuneWorkgroups) {
+		autotuneWorkgroupSizes();
+		reset();
+	}
+}
+
+vector<SPHgpu::Stage*> SPHgpu::stages() {
+	return {&updateStage, &densityStage, &particleRecStage, &sortParticleRecStage, &cellRecStage, &particleRebinStage, &pcisphStage, &healthStage, &surfaceStage, &initStage};
+}
+
+vector<string> SPHgpu::stageDefines(const Stage& s) {
+	vector<string> defines = {
+		"LOCAL_SIZE " + to_string(s.localSize),
+		"SUBDIVISION_N " + to_string(config.SubdivisionN) + "u",
+		"KERNEL_H " + glslFloat(config.H),
+	};
+	// without obstacles the programs do not sample the distance field at all
+	if(b.obstacles)
+		defines.push_back("OBSTACLES");
+	if(config.Solver == PressureSolver::PCISPH)
+		defines.push_back("PCISPH");
+	if(config.LazyReorder)
+		defines.push_back("LAZY_REORDER");
+	// the update stage finds the cells of the new positions for the grid of the next step
+	if(&s == &updateStage) {
+		defines.push_back("FUSED_CELL_ID");
+		if(config.IncrementalRebinning)
+			defines.push_back("INCREMENTAL_REBINNING");
+	}
+	if(&s == &healthStage)
+		defines.push_back("OCCUPANCY_BIN_N " + to_string(HealthMetrics::OccupancyBinN) + "u");
+	return defines;
+}
+
+void SPHgpu::loadPrograms() {
+	loadPrograms(stages());
+}
+
+void SPHgpu::loadPrograms(const vector<Stage*>& toLoad) {
+	// all the programs are loaded at once so that they can be compiled in parallel
+	vector<ShaderProgramSource> sources;
+	for(Stage* s : toLoad)
+		sources.push_back({{make_tuple(GL_COMPUTE_SHADER, s->file)}, stageDefines(*s)});
+	vector<GLuint> programs = loadShaderPrograms(sources);
+	for(unsigned i = 0; i < programs.size(); ++i) {
+		Stage& s = *toLoad[i];
+		if(!programs[i])
+			cerr << "Failed to load compute shader program " << s.file << endl;
+		if(s.program)
+			glDeleteProgram(s.program);
+		s.program = programs[i];
+	}
+	programsH = config.H;
+}
+
+unsigned SPHgpu::groupN(const Stage& s, unsigned invocationN) {
+	return (invocationN + s.localSize-1)/s.localSize;
+}
+
+string SPHgpu::workgroupSizesKey() {
+	ostringstream key;
+	key << hex << hashString(driverString()) << dec << "_" << config.particleN << "_" << config.SubdivisionN;
+	return key.str();
+}
+
+void SPHgpu::loadWorkgroupSizes() {
+	if(getProgramBinaryCacheDir().empty())
+		return;
+	ifstream f(getProgramBinaryCacheDir() + "/workgroups.txt");
+	string key, file;
+	unsigned localSize;
+	while(f >> key >> file >> localSize) {
+		if(key != workgroupSizesKey())
+			continue;
+		for(Stage* s : stages())
+			if(s->file == file)
+				s->localSize = localSize;
+	}
+}
+
+void SPHgpu::storeWorkgroupSizes() {
+	if(getProgramBinaryCacheDir().empty())
+		return;
+	string path = getProgramBinaryCacheDir() + "/workgroups.txt";
+	// keep the entries of other devices and problem sizes
+	vector<string> lines;
+	{
+		ifstream f(path);
+		string line;
+		while(getline(f, line))
+			if(line.compare(0, workgroupSizesKey().size()+1, workgroupSizesKey() + " ") != 0)
+				lines.push_back(line);
+	}
+	ofstream f(path);
+	for(const string& line : lines)
+		f << line << "\n";
+	for(Stage* s : stages())
+		f << workgroupSizesKey() << " " << s->file << " " << s->localSize << "\n";
+}
+
+void SPHgpu::autotuneWorkgroupSizes() {
+	const unsigned warmupStepN = 2;
+	const unsigned measuredStepN = 5;
+	GLint maxInvocations;
+	glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &maxInvocations);
+	cout << "Autotuning workgroup sizes\n";
+	// one stage at a time, the others keep their best size found so far
+	for(Stage* s : stages()) {
+		// the health reduction, the meshing and the initialization are not part of the measured step
+		if(s == &healthStage || s == &surfaceStage || s == &initStage)
+			continue;
+		const unsigned initial = s->localSize;
+		unsigned best = initial;
+		GLuint64 bestTime = numeric_limits<GLuint64>::max();
+		for(unsigned localSize = 32; localSize <= unsigned(maxInvocations) && localSize <= 1024; localSize *= 2) {
+			s->localSize = localSize;
+			// only the tuned stage is recompiled, only its dispatches are timed
+			loadPrograms({s});
+			if(!s->program)
+				continue;
+			for(unsigned i = 0; i < warmupStepN; ++i)
+				step();
+			timedStage = s;
+			timedStageTime = 0;
+			for(unsigned i = 0; i < measuredStepN; ++i)
+				step();
+			timedStage = nullptr;
+			// the stage is not dispatched in this configuration
+			if(timedStageTime == 0) {
+				best = initial;
+				break;
+			}
+			if(timedStageTime < bestTime) {
+				bestTime = timedStageTime;
+				best = localSize;
+			}
+		}
+		s->localSize = best;
+		loadPrograms({s});
+		cout << "  " << s->file << ": " << best << endl;
+	}
+	storeWorkgroupSizes();
 }
 
 void SPHgpu::reset() {
+	// generated on the device, only the few fluid blocks are uploaded
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, particlePositionBuff);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, config.particleN*sizeof(vec4), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleVelocityBuff);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, config.particleN*sizeof(vec4), NULL, GL_DYNAMIC_COPY);
+	InitialState state(config, b);
+	bufferData(initialBlockBuffer, state.blocks(), GL_STATIC_DRAW);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, particlePositionBuff);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, particleVelocityBuff);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 25, initialBlockBuffer);
+	if(b.obstacles) {
+		// the nodes inside the obstacles are skipped with the same distance field as on the host
+		std::vector<unsigned> nodes = state.latticeNodes();
+		if(nodes.empty())
+			nodes.push_back(0);
+		bufferData(latticeNodeBuffer, nodes, GL_STATIC_DRAW);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 28, latticeNodeBuffer);
+	}
+	GLuint program = initStage.program;
+	glUseProgram(program);
+	setConfigUniforms(program);
+	glUniform1ui(glGetUniformLocation(program, "particleN"), config.particleN);
+	glUniform1ui(glGetUniformLocation(program, "seed"), config.Seed);
+	glUniform1i(glGetUniformLocation(program, "lattice"), config.Layout == InitialLayout::Lattice);
+	glUniform1f(glGetUniformLocation(program, "latticeJitter"), config.LatticeJitter);
+	glDispatchCompute(groupN(initStage, config.particleN), 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+	resetParticleIDs();
+	cellRecordsValid = false;
+	stepsSinceReorder = 0;
+	displacedFraction = 0;
+}
+
+void SPHgpu::resetParticleIDs() {
+	vector<GLuint> id(config.particleN);
+	iota(id.begin(), id.end(), 0);
+	bufferData(particleIDBuffer, id, GL_DYNAMIC_COPY);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 26, particleIDBuffer);
+}
+
+vector<unsigned> SPHgpu::sortedParticles() {
+	vector<unsigned> order(config.particleN);
+	if(!(config.LazyReorder && cellRecordsValid)) {
+		iota(order.begin(), order.end(), 0);
+		return order;
+	}
+	vector<ParticleRecord> records(config.particleN);
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleRecBuffer);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, records.size()*sizeof(ParticleRecord), records.data());
+	for(unsigned i = 0; i < config.particleN; ++i)
+		order[i] = records[i].particleID;
+	return order;
+}
+
+void SPHgpu::getParticles(std::vector<vec3>& pos, std::vector<vec3>& vel) {
+	pos = readVec3Buffer(particlePositionBuff);
+	vel = readVec3Buffer(particleVelocityBuff);
+}
+
+void SPHgpu::setParticles(const std::vector<vec3>& pos, const std::vector<vec3>& vel) {
 	vector<vec4> particlePos(config.particleN);
 	vector<vec4> particleVel(config.particleN);
-	for(vec4& p : particlePos)
-		p = vec4(b.min + (b.max-b.min)*vec3(frand(), frand(), frand()), 0);
-	for(vec4& v : particleVel)
-		v = normalize(vec4(rand(), rand(), rand(), 0));
+	for(unsigned i = 0; i < config.particleN; ++i) {
+		particlePos[i] = vec4(pos[i], 0);
+		particleVel[i] = vec4(vel[i], 0);
+	}
 	bufferData(particlePositionBuff, particlePos, GL_DYNAMIC_COPY);
 	bufferData(particleVelocityBuff, particleVel, GL_DYNAMIC_COPY);
+	resetParticleIDs();
+	cellRecordsValid = false;
+	stepsSinceReorder = 0;
+	displacedFraction = 0;
+}
+
+void SPHgpu::getParticleIDs(std::vector<unsigned>& id) {
+	vector<GLuint> data(config.particleN);
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleIDBuffer);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, data.size()*sizeof(GLuint), data.data());
+	vector<unsigned> order = sortedParticles();
+	id.resize(config.particleN);
+	for(unsigned i = 0; i < config.particleN; ++i)
+		id[i] = data[order[i]];
+}
+
+void SPHgpu::getDensities(std::vector<float>& density) {
+	vector<float> data(config.particleN);
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, densityBuff);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, data.size()*sizeof(float), data.data());
+	// in the order of the cell records, as the positions
+	vector<unsigned> order = sortedParticles();
+	density.resize(config.particleN);
+	for(unsigned i = 0; i < config.particleN; ++i)
+		density[i] = data[order[i]];
+}
+
+void SPHgpu::getCellRecords(std::vector<CellRecord>& cellRecords) {
+	cellRecords.resize(config.SubdivisionN*config.SubdivisionN*config.SubdivisionN);
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, cellRecBuffer);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, cellRecords.size()*sizeof(CellRecord), cellRecords.data());
+}
+
+vector<vec3> SPHgpu::readVec3Buffer(GLuint buffer) {
+	vector<vec4> data(config.particleN);
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, data.size()*sizeof(vec4), data.data());
+	vector<unsigned> order = sortedParticles();
+	vector<vec3> r(config.particleN);
+	for(unsigned i = 0; i < config.particleN; ++i)
+		r[i] = vec3(data[order[i]].x, data[order[i]].y, data[order[i]].z);
+	return r;
 }
 
 void SPHgpu::update() {
@@ -61,6 +406,9 @@ void SPHgpu::update() {
 		frameTime = double(qr)/1000/1000;
 		queryActive = false;
 	}
+	// the programs are specialized for the kernel radius
+	if(config.H != programsH)
+		loadPrograms();
 	if(!queryActive) {
 		glBeginQuery(GL_TIME_ELAPSED, queryID);
 		step();
@@ -72,59 +420,369 @@ void SPHgpu::update() {
 }
 
 void SPHgpu::step() {
+	dispatchN = 0;
+	movedBytes = 0;
+	++stepsSinceReorder;
+	// particles which changed their cell in the last update
+	unsigned changedN = 0;
+	if(cellRecordsValid && (config.IncrementalRebinning || config.LazyReorder)) {
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, rebinCounterBuffer);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(changedN), &changedN);
+		displacedFraction += float(changedN)/config.particleN;
+	}
 	// prepare NN data structure (uniform grid)
-	// calculate particle record for each particle (particle ID, cell ID)
-	glUseProgram(particleRecProgram);
-	setConfigUniforms(particleRecProgram);
-	glDispatchCompute(config.particleN/localGroupSize, 1, 1); // one invocation per particle
+	fullRebuild = !(config.IncrementalRebinning && cellRecordsValid && rebinIncrementally(changedN));
+	if(fullRebuild)
+		rebuildCellRecords();
+	unsigned recordBytes = config.LazyReorder ? RecordBytes : 0; // the indirection of each particle
+
+	// compute density at each particle's location
+	glUseProgram(densityStage.program);
+	setConfigUniforms(densityStage.program);
+	glUniform1i(glGetUniformLocation(densityStage.program, "correctPressure"), 0);
+	dispatch(densityStage, config.particleN, VecBytes + FloatBytes + recordBytes);
 	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 
-	// sort the records by cellID
-	glUseProgram(sortParticleRecProgram);
-	for(size_t l = 2; l < 2*config.particleN; l *= 2) {
-		for(size_t seqLen = l; seqLen > 1; seqLen /= 2) {
-			glUniform1ui(glGetUniformLocation(sortParticleRecProgram, "seqLen"), seqLen);
-			glUniform1ui(glGetUniformLocation(sortParticleRecProgram, "blockLen"), l);
-			glDispatchCompute(config.particleN/localGroupSize, 1, 1);
-			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	if(collectHealth)
+		computeHealth();
+
+	if(config.Solver == PressureSolver::PCISPH)
+		solvePcisph();
+
+	// the timestamps of the previous step, read without waiting
+	if(collisionQueryActive) {
+		GLint available = GL_FALSE;
+		glGetQueryObjectiv(collisionQueryIDs[1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if(available) {
+			GLuint64 begin, end;
+			glGetQueryObjectui64v(collisionQueryIDs[0], GL_QUERY_RESULT, &begin);
+			glGetQueryObjectui64v(collisionQueryIDs[1], GL_QUERY_RESULT, &end);
+			collisionTime = double(end - begin)/1000/1000;
+			collisionQueryActive = false;
 		}
 	}
+	const bool timeCollision = !collisionQueryActive;
 
-	// update cell records (first_particle_rec, particle_rec_n)
-	glUseProgram(cellRecProgram);
-	glDispatchCompute(1, 1, 1);
-	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	// update particle positions and velocities, find their new cells
+	if(config.IncrementalRebinning || config.LazyReorder) {
+		changedN = 0;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, rebinCounterBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(changedN), &changedN);
+	}
+	glUseProgram(updateStage.program);
+	setConfigUniforms(updateStage.program);
+	unsigned updateBytes = config.Solver == PressureSolver::PCISPH ? 6*VecBytes : 4*VecBytes + FloatBytes;
+	// the record of the old cell, the full rebuild gets all the new records
+	updateBytes += config.IncrementalRebinning ? RecordBytes : 2*RecordBytes;
+	if(timeCollision)
+		glQueryCounter(collisionQueryIDs[0], GL_TIMESTAMP);
+	dispatch(updateStage, config.particleN, updateBytes);
+	if(timeCollision) {
+		glQueryCounter(collisionQueryIDs[1], GL_TIMESTAMP);
+		collisionQueryActive = true;
+	}
+	// the next step reads the counter of the changed particles
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
 
-	// reorder particle position and velocity according to the order of particleRecords
-	glUseProgram(particleReorderProgram);
-	glDispatchCompute(config.particleN/localGroupSize, 1, 1);
-	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 	swap(particlePositionBuff, particlePositionBuffOut);
-	swap(particleVelocityBuff, particleVelocityBuffOut);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, particlePositionBuff);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, particlePositionBuffOut);
+	setParticlePositionAttrBuffer(4);
+	swap(particleVelocityBuff, particleVelocityBuffOut);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, particleVelocityBuff);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, particleVelocityBuffOut);
+}
 
-	// compute density at each particle's location
-	glUseProgram(densityProgram);
-	setConfigUniforms(densityProgram);
-	glDispatchCompute(config.particleN/localGroupSize, 1, 1);
+void SPHgpu::dispatch(const Stage& s, unsigned invocationN, unsigned invocationBytes) {
+	if(&s == timedStage) {
+		glBeginQuery(GL_TIME_ELAPSED, timedStageQueryID);
+		glDispatchCompute(groupN(s, invocationN), 1, 1);
+		glEndQuery(GL_TIME_ELAPSED);
+		GLuint64 t;
+		glGetQueryObjectui64v(timedStageQueryID, GL_QUERY_RESULT, &t);
+		timedStageTime += t;
+	}
+	else
+		glDispatchCompute(groupN(s, invocationN), 1, 1);
+	++dispatchN;
+	movedBytes += (unsigned long long)invocationN*invocationBytes;
+}
+
+void SPHgpu::solvePcisph() {
+	GLuint program = pcisphStage.program;
+	unsigned recordBytes = config.LazyReorder ? RecordBytes : 0;
+	glUseProgram(densityStage.program);
+	glUniform1f(glGetUniformLocation(densityStage.program, "Delta"), pcisphDelta(config));
+	// accelerations and the predicted positions
+	glUseProgram(program);
+	setConfigUniforms(program);
+	glUniform1ui(glGetUniformLocation(program, "pass"), 0);
+	dispatch(pcisphStage, config.particleN, 5*VecBytes + 2*FloatBytes + recordBytes);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	for(pressureIterations = 0; pressureIterations < config.MaxPressureIterations; ) {
+		// the density pass on the predicted positions corrects the pressure
+		GLuint maxError = 0;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, densityErrorBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(maxError), &maxError);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, predictedDensityBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, predictedPositionBuffer);
+		glUseProgram(densityStage.program);
+		glUniform1i(glGetUniformLocation(densityStage.program, "correctPressure"), 1);
+		dispatch(densityStage, config.particleN, VecBytes + 3*FloatBytes + recordBytes);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, densityBuff);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, particlePositionBuff);
+
+		// pressure accelerations and the next prediction
+		glUseProgram(program);
+		glUniform1ui(glGetUniformLocation(program, "pass"), 1);
+		dispatch(pcisphStage, config.particleN, 5*VecBytes + 2*FloatBytes + recordBytes);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		++pressureIterations;
+		if(pressureIterations < config.MinPressureIterations)
+			continue;
+		// the convergence test waits for the GPU
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, densityErrorBuffer);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(maxError), &maxError);
+		float e;
+		memcpy(&e, &maxError, sizeof(e));
+		if(e < config.DensityTolerance)
+			break;
+	}
+}
+
+void SPHgpu::computeHealth() {
+	GLuint occupancy[HealthMetrics::OccupancyBinN+1] = {};
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, healthOccupancyBuffer);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(occupancy), occupancy);
+	GLuint program = healthStage.program;
+	glUseProgram(program);
+	setConfigUniforms(program);
+	glUniform1ui(glGetUniformLocation(program, "pass"), 0);
+	dispatch(healthStage, config.SubdivisionN*config.SubdivisionN*config.SubdivisionN, sizeof(CellRecord));
+	glUniform1ui(glGetUniformLocation(program, "pass"), 1);
+	unsigned partialN = groupN(healthStage, config.particleN);
+	dispatch(healthStage, config.particleN, VecBytes + FloatBytes);
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	// mirrors HealthPartial of Health.comp
+	struct Partial {
+		GLuint candidates;
+		GLuint inRange;
+		float errorSum;
+		float errorSqSum;
+		float maxError;
+		float minDensity;
+		float maxDensity;
+		GLuint pad;
+	};
+	vector<Partial> partials(partialN);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, healthOccupancyBuffer);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(occupancy), occupancy);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, healthPartialBuffer);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, partials.size()*sizeof(Partial), partials.data());
+	HealthMetrics& m = health;
+	m = {};
+	copy(occupancy, occupancy+HealthMetrics::OccupancyBinN, m.occupancy);
+	m.maxOccupancy = occupancy[HealthMetrics::OccupancyBinN];
+	m.minDensity = numeric_limits<float>::max();
+	m.maxDensity = numeric_limits<float>::lowest();
+	double errorSum = 0, errorSqSum = 0;
+	for(const Partial& p : partials) {
+		m.candidates += p.candidates;
+		m.inRange += p.inRange;
+		errorSum += p.errorSum;
+		errorSqSum += p.errorSqSum;
+		m.maxDensityError = std::max(m.maxDensityError, p.maxError);
+		m.minDensity = std::min(m.minDensity, p.minDensity);
+		m.maxDensity = std::max(m.maxDensity, p.maxDensity);
+	}
+	m.meanDensityError = errorSum/config.particleN;
+	m.rmsDensityError = sqrt(errorSqSum/config.particleN);
+}
+
+void SPHgpu::extractSurface(const SurfaceConfig& sc, SurfaceMesh& mesh) {
+	mesh.vertices.clear();
+	mesh.normals.clear();
+	if(!cellRecordsValid)
+		return;
+	// not counted in dispatchN and movedBytes, the meshing is not part of the step
+	const unsigned cellN = config.SubdivisionN*config.SubdivisionN*config.SubdivisionN;
+	const unsigned s = std::max(1u, sc.samplesPerCell);
+	GLuint program = surfaceStage.program;
+	glUseProgram(program);
+	setConfigUniforms(program);
+	glUniform1ui(glGetUniformLocation(program, "samplesPerCell"), s);
+	glUniform1f(glGetUniformLocation(program, "isoLevel"), sc.isoLevel);
+	GLuint counters[4] = {};
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, surfaceCellBuffer);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counters), counters);
+	glUniform1ui(glGetUniformLocation(program, "pass"), 0);
+	glDispatchCompute(groupN(surfaceStage, cellN), 1, 1);
 	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	glUniform1ui(glGetUniformLocation(program, "pass"), 1);
+	glDispatchCompute(groupN(surfaceStage, cellN), 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counters), counters);
+	const unsigned activeN = counters[0], sampledN = counters[1];
+	if(activeN == 0)
+		return;
 
-	// update particle positions and velocities
-	glUseProgram(updateProgram);
-	setConfigUniforms(updateProgram);
-	glDispatchCompute(config.particleN/localGroupSize, 1, 1);
+	const unsigned nodeN = sampledN*(s+1)*(s+1)*(s+1);
+	if(nodeN > surfaceNodeCapacity) {
+		surfaceNodeCapacity = nodeN;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, surfaceNodeBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, surfaceNodeCapacity*sizeof(vec4), NULL, GL_DYNAMIC_COPY);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 22, surfaceNodeBuffer);
+	}
+	glUniform1ui(glGetUniformLocation(program, "pass"), 2);
+	glDispatchCompute(groupN(surfaceStage, nodeN), 1, 1);
 	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 
+	// the triangles are appended without counting them first, the pass is repeated if the vertex buffer overflowed
+	glUniform1ui(glGetUniformLocation(program, "pass"), 3);
+	for(GLuint vertexN = 0; ; ) {
+		if(surfaceVertexCapacity == 0 || vertexN > surfaceVertexCapacity) {
+			surfaceVertexCapacity = std::max(2*vertexN, 3*MarchingCubesRow*activeN);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, surfaceVertexBuffer);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, surfaceVertexCapacity*2*sizeof(vec4), NULL, GL_DYNAMIC_READ);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 24, surfaceVertexBuffer);
+		}
+		vertexN = 0;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, surfaceCellBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 2*sizeof(GLuint), sizeof(vertexN), &vertexN);
+		glDispatchCompute(groupN(surfaceStage, activeN*s*s*s), 1, 1);
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 2*sizeof(GLuint), sizeof(vertexN), &vertexN);
+		if(vertexN <= surfaceVertexCapacity) {
+			vector<vec4> vertices(2*vertexN);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, surfaceVertexBuffer);
+			glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, vertices.size()*sizeof(vec4), vertices.data());
+			mesh.vertices.resize(vertexN);
+			mesh.normals.resize(vertexN);
+			for(unsigned i = 0; i < vertexN; ++i) {
+				mesh.vertices[i] = vec3(vertices[2*i]);
+				mesh.normals[i] = vec3(vertices[2*i+1]);
+			}
+			return;
+		}
+	}
+}
+
+void SPHgpu::rebuildCellRecords() {
+	// particle record for each particle (particle ID, cell ID) - from the update stage of the last step if it wrote them all
+	if(cellRecordsValid && !config.IncrementalRebinning) {
+		swap(particleRecBuffer, particleRecBufferOut);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, particleRecBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, particleRecBufferOut);
+	}
+	else {
+		glUseProgram(particleRecStage.program);
+		setConfigUniforms(particleRecStage.program);
+		dispatch(particleRecStage, config.particleN, VecBytes + RecordBytes); // one invocation per particle
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+
+	// sort the records by cellID
+	sortParticleRecords(particleRecBuffer, config.particleN);
+
+	// the initial particle order has no locality at all
+	updateCellRecords(!cellRecordsValid || reorderDue());
+	cellRecordsValid = true;
+}
+
+bool SPHgpu::rebinIncrementally(unsigned changedN) {
+	// the particles are ordered by the cells from the last step - particleRecBuffer holds their previous cells,
+	// the update stage collected the particles which changed their cell
+	rebinnedFraction = float(changedN)/config.particleN;
+	if(rebinnedFraction > config.RebinThreshold)
+		return false;
+	if(changedN == 0) {
+		// the grid and the records still hold, only the lazy mode may have a reorder of the data due
+		if(config.LazyReorder && reorderDue())
+			updateCellRecords(true);
+		return true;
+	}
+
+	// the bitonic sort needs power of two elements, the padding goes to the end
+	unsigned sortN = 1;
+	while(sortN < changedN)
+		sortN *= 2;
+	for(GLuint buffer : {changedByCellBuffer, changedByParticleBuffer}) {
+		GLuint padding = numeric_limits<GLuint>::max();
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+		glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, changedN*sizeof(ParticleRecord), (sortN-changedN)*sizeof(ParticleRecord), GL_RED_INTEGER, GL_UNSIGNED_INT, &padding);
+		sortParticleRecords(buffer, sortN);
+	}
+
+	// merge the unchanged records (still sorted) with the small sorted set of the changed ones
+	glUseProgram(particleRebinStage.program);
+	dispatch(particleRebinStage, config.particleN, 2*RecordBytes);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	swap(particleRecBuffer, particleRecBufferOut);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, particleRecBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, particleRecBufferOut);
+
+	updateCellRecords(reorderDue());
+	return true;
+}
+
+void SPHgpu::sortParticleRecords(GLuint buffer, unsigned n) {
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 4, buffer, 0, n*sizeof(ParticleRecord));
+	GLuint sortProgram = sortParticleRecStage.program;
+	glUseProgram(sortProgram);
+	for(size_t l = 2; l < 2*n; l *= 2) {
+		for(size_t seqLen = l; seqLen > 1; seqLen /= 2) {
+			glUniform1ui(glGetUniformLocation(sortProgram, "seqLen"), seqLen);
+			glUniform1ui(glGetUniformLocation(sortProgram, "blockLen"), l);
+			// the compares read every record once, the swaps write at most as much
+			dispatch(sortParticleRecStage, n, RecordBytes);
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		}
+	}
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, particleRecBuffer);
+}
+
+bool SPHgpu::reorderDue() {
+	return !config.LazyReorder || stepsSinceReorder >= config.ReorderPeriod || displacedFraction > config.ReorderThreshold;
+}
+
+void SPHgpu::updateCellRecords(bool reorder) {
+	// (first_particle_rec, particle_rec_n) for each cell, the empty cells stay cleared
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, cellRecBuffer);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+	movedBytes += config.SubdivisionN*config.SubdivisionN*config.SubdivisionN*sizeof(CellRecord);
+	glUseProgram(cellRecStage.program);
+	glUniform1ui(glGetUniformLocation(cellRecStage.program, "pass"), reorder ? 2 : 1);
+	dispatch(cellRecStage, config.particleN, reorder ? RecordBytes + 4*VecBytes + 3*sizeof(GLuint) : RecordBytes);
+	// the clear of the next step waits for these writes
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+	if(!reorder)
+		return;
 	swap(particlePositionBuff, particlePositionBuffOut);
+	swap(particleVelocityBuff, particleVelocityBuffOut);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, particlePositionBuff);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, particlePositionBuffOut);
-	setParticlePositionAttrBuffer(4);
-	swap(particleVelocityBuff, particleVelocityBuffOut);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, particleVelocityBuff);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, particleVelocityBuffOut);
+	swap(particleIDBuffer, particleIDBufferOut);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 26, particleIDBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 27, particleIDBufferOut);
+	stepsSinceReorder = 0;
+	displacedFraction = 0;
+}
+
+void SPHgpu::uploadObstacles() {
+	const SignedDistanceField& sdf = *b.obstacles;
+	glGenTextures(1, &obstacleTexture);
+	glBindTexture(GL_TEXTURE_3D, obstacleTexture);
+	// linear filtering does the trilinear interpolation
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexImage3D(GL_TEXTURE_3D, 0, GL_R32F, sdf.size.x, sdf.size.y, sdf.size.z, 0, GL_RED, GL_FLOAT, sdf.values.data());
 }
 
 void SPHgpu::setConfigUniforms(GLuint program) {
@@ -137,4 +795,14 @@ void SPHgpu::setConfigUniforms(GLuint program) {
 	glUniform1ui(glGetUniformLocation(program, "SubdivisionN"), config.SubdivisionN);
 	glUniform3fv(glGetUniformLocation(program, "boundsMin"), 1, &b.min[0]);
 	glUniform3fv(glGetUniformLocation(program, "boundsMax"), 1, &b.max[0]);
+	if(b.obstacles) {
+		const SignedDistanceField& sdf = *b.obstacles;
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_3D, obstacleTexture);
+		glUniform1i(glGetUniformLocation(program, "obstacleSdf"), 0);
+		glUniform3fv(glGetUniformLocation(program, "sdfMin"), 1, &sdf.min[0]);
+		glUniform3fv(glGetUniformLocation(program, "sdfExtent"), 1, &sdf.extent[0]);
+		glUniform3f(glGetUniformLocation(program, "sdfTexel"), 1.f/sdf.size.x, 1.f/sdf.size.y, 1.f/sdf.size.z);
+		glUniform1f(glGetUniformLocation(program, "sdfSpacing"), sdf.spacing);
+	}
 }
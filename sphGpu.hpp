@@ -16,26 +16,115 @@ class SPHgpu: public SPH {
 		SPHgpu(SPHconfig &config, Bounds& _b);
 		void reset() override;
 		void update() override;
+		void getParticles(std::vector<vec3>& pos, std::vector<vec3>& vel) override;
+		void setParticles(const std::vector<vec3>& pos, const std::vector<vec3>& vel) override;
+		void getParticleIDs(std::vector<unsigned>& id) override;
+		void getDensities(std::vector<float>& density) override;
+		void getCellRecords(std::vector<CellRecord>& cellRecords) override;
+		/// marching cubes in the compute shader on the grid of the last step (Surface.comp)
+		void extractSurface(const SurfaceConfig& sc, SurfaceMesh& mesh) override;
 
 	private:
+		/// single compute shader program, specialized for its workgroup size and the simulation constants
+		struct Stage {
+			std::string file;
+			unsigned localSize;
+			GLuint program;
+		};
+
 		void step();
+		/// PCISPH pressure iterations, the accelerations are then integrated by the update stage
+		void solvePcisph();
+		/// reduces the grid and the density statistics of this step into health (waits for the GPU)
+		void computeHealth();
+		/// computes the particle records from scratch, sorts them and rebuilds the cell records
+		void rebuildCellRecords();
+		/// moves only the particles which changed their cell (found by the update stage), falls back to the full rebuild above config.RebinThreshold
+		/// \return false if the full rebuild is needed
+		bool rebinIncrementally(unsigned changedN);
+		/// sorts the first n (power of two) particle records in the buffer by the cell ID
+		void sortParticleRecords(GLuint buffer, unsigned n);
+		/// \param reorder the particle positions and velocities are reordered according to particleRecords in the same pass
+		void updateCellRecords(bool reorder);
+		/// the lazy reorder sorts the particle data only every config.ReorderPeriod steps or when the locality degraded
+		bool reorderDue();
+		/// glDispatchCompute counted in dispatchN and movedBytes
+		/// \param invocationBytes buffer traffic of one invocation on its own elements
+		void dispatch(const Stage& s, unsigned invocationN, unsigned invocationBytes);
+		/// particle of each position of the cell record order (identity unless the lazy reorder left the data unsorted)
+		std::vector<unsigned> sortedParticles();
 		void setConfigUniforms(GLuint program);
+		/// copies the obstacle distance field into a 3D texture
+		void uploadObstacles();
+		/// (re)loads the program variants of all the stages
+		void loadPrograms();
+		void loadPrograms(const std::vector<Stage*>& toLoad);
+		std::vector<std::string> stageDefines(const Stage& s);
+		/// number of workgroups needed for invocationN invocations
+		unsigned groupN(const Stage& s, unsigned invocationN);
+		/// times the candidate workgroup sizes for each stage, keeps the fastest one
+		void autotuneWorkgroupSizes();
+		/// the autotuned workgroup sizes are cached for the driver and the problem size
+		std::string workgroupSizesKey();
+		void loadWorkgroupSizes();
+		void storeWorkgroupSizes();
+		std::vector<Stage*> stages();
+		/// reads vec4 buffer of particle data in the order of the cell records, drops the w component
+		std::vector<vec3> readVec3Buffer(GLuint buffer);
+		/// particleIDBuffer of the particle order after the reset or setParticles
+		void resetParticleIDs();
 
 	private:
 		GLuint queryID;
 		bool queryActive;
+		GLuint collisionQueryIDs[2]; /// timestamps around the update pass, which handles the collision
+		bool collisionQueryActive;
+		const Stage* timedStage; /// autotuning: the dispatches of this stage are timed into timedStageTime
+		GLuint timedStageQueryID;
+		GLuint64 timedStageTime;
 		GLuint particleVelocityBuff;
 		GLuint particleVelocityBuffOut;
 		GLuint particlePositionBuffOut;
 		GLuint densityBuff;
 		GLuint particleRecBuffer;
 		GLuint cellRecBuffer;
-		GLuint updateProgram;
-		GLuint densityProgram;
-		GLuint particleRecProgram;
-		GLuint sortParticleRecProgram;
-		GLuint cellRecProgram;
-		GLuint particleReorderProgram;
+		GLuint particleRecBufferOut;
+		GLuint changedByCellBuffer; /// particles which changed their cell (incremental rebinning)
+		GLuint changedByParticleBuffer;
+		GLuint rebinCounterBuffer;
+		GLuint obstacleTexture; /// signed distance field of Bounds::obstacles
+		GLuint pressureBuffer; /// PCISPH
+		GLuint accelerationNpBuffer; /// PCISPH: non-pressure acceleration
+		GLuint accelerationPBuffer; /// PCISPH: pressure acceleration
+		GLuint predictedPositionBuffer; /// PCISPH
+		GLuint predictedDensityBuffer; /// PCISPH
+		GLuint densityErrorBuffer; /// PCISPH: max predicted compression
+		GLuint healthOccupancyBuffer; /// health: occupancy histogram, max occupancy
+		GLuint healthPartialBuffer; /// health: statistics of each workgroup
+		GLuint surfaceCellBuffer; /// surface: counters, active and sampled cells
+		GLuint surfaceNodeBuffer; /// surface: colour field at the voxel nodes, grows as needed
+		GLuint marchingCubesBuffer; /// surface: marchingCubesTable()
+		GLuint surfaceVertexBuffer; /// surface: position and normal of each vertex, grows as needed
+		GLuint initialBlockBuffer; /// InitialState::blocks() for the initialization
+		GLuint latticeNodeBuffer; /// InitialState::latticeNodes() for the initialization with obstacles
+		GLuint particleIDBuffer; /// index of each particle in the last reset or setParticles, reordered with the particles
+		GLuint particleIDBufferOut;
+		bool cellRecordsValid; /// particleRecBuffer and cellRecBuffer correspond to the current particle positions
+		unsigned stepsSinceReorder; /// lazy reorder
+		float displacedFraction; /// lazy reorder: cell changes since the last sort of the particle data per particle
+		unsigned surfaceNodeCapacity; /// vec4 elements of surfaceNodeBuffer
+		unsigned surfaceVertexCapacity; /// vertices of surfaceVertexBuffer
+		Stage updateStage;
+		Stage densityStage;
+		Stage particleRecStage;
+		Stage sortParticleRecStage;
+		Stage cellRecStage;
+		Stage particleRebinStage;
+		Stage pcisphStage;
+		Stage healthStage;
+		Stage surfaceStage;
+		Stage initStage;
+		float programsH; /// kernel radius the programs were specialized for
 };
 
 #endif /* SPHGPU_HPP_20_01_07_21_10_21 */
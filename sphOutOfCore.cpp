@@ -0,0 +1,394 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <limits>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "initialState.hpp"
+#include "sphOutOfCore.hpp"
+#include "sphRegistry.hpp"
+#include "utils.hpp"
+using namespace std;
+using namespace glm;
+
+static SPHregistration registration("outofcore", [](SPHconfig& config, Bounds& b) { return unique_ptr<SPH>(new SPHoutOfCore(config, b)); }, {false, false});
+
+static size_t pageSize() {
+	static const size_t size = sysconf(_SC_PAGESIZE);
+	return size;
+}
+
+void prefetchPages(void* data, size_t begin, size_t end) {
+	if(begin >= end)
+		return;
+	// the whole pages around the range
+	size_t page = pageSize();
+	char* first = static_cast<char*>(data) + begin/page*page;
+	char* last = static_cast<char*>(data) + (end+page-1)/page*page;
+	madvise(first, last-first, MADV_WILLNEED);
+	// the read-ahead is only a hint, the pages are faulted in here and not by the computation
+	for(volatile char* p = first; p < last; p += page)
+		(void)*p;
+}
+
+void releasePages(void* data, size_t begin, size_t end) {
+	// only the pages fully inside the range, the boundary ones may still be in use by the neighbouring slab
+	size_t page = pageSize();
+	size_t first = (begin+page-1)/page*page;
+	size_t last = end/page*page;
+	if(first < last)
+		madvise(static_cast<char*>(data) + first, last-first, MADV_DONTNEED);
+}
+
+template <typename T>
+MappedArray<T>::~MappedArray() {
+	if(data)
+		munmap(data, n*sizeof(T));
+}
+
+template <typename T>
+bool MappedArray<T>::create(const std::string& dir, size_t _n) {
+	string file = dir + "/sphXXXXXX";
+	int fd = mkstemp(&file[0]);
+	if(fd < 0) {
+		cerr << "Cannot create a file in " << dir << endl;
+		return false;
+	}
+	// the mapping keeps the data, the file disappears with the process even if it crashes
+	unlink(file.c_str());
+	void* p = MAP_FAILED;
+	if(ftruncate(fd, _n*sizeof(T)) == 0)
+		p = mmap(nullptr, _n*sizeof(T), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED) {
+		cerr << "Cannot map " << _n*sizeof(T) << " bytes of " << file << endl;
+		return false;
+	}
+	data = static_cast<T*>(p);
+	n = _n;
+	return true;
+}
+
+template class MappedArray<vec3>;
+template class MappedArray<float>;
+template class MappedArray<unsigned>;
+
+SPHoutOfCore::SPHoutOfCore(SPHconfig &config, Bounds& _b): SPH{config, _b}, slabLayers{std::max(config.SlabLayers, 1u)} {
+	if(config.Solver != PressureSolver::WCSPH || config.LocalTimeStepping)
+		cerr << "The out-of-core run supports only the WCSPH solver with global steps, used instead\n";
+	error_code e;
+	filesystem::create_directories(config.OutOfCoreDir, e);
+	const string& dir = config.OutOfCoreDir;
+	const unsigned n = config.particleN;
+	if(!pos.create(dir, n) || !vel.create(dir, n) || !density.create(dir, n)
+			|| !posOut.create(dir, n) || !velOut.create(dir, n) || !cellOut.create(dir, n)
+			|| !particleID.create(dir, n) || !particleIDOut.create(dir, n))
+		exit(EXIT_FAILURE);
+	const unsigned subdivisionN = config.SubdivisionN;
+	cellRecords.resize(subdivisionN*subdivisionN*subdivisionN);
+	binCount.resize(cellRecords.size());
+	layerFirsts.resize(subdivisionN+1);
+	binSourceFirst.resize(subdivisionN);
+	binSourceEnd.resize(subdivisionN);
+	reset();
+}
+
+void SPHoutOfCore::reset() {
+	InitialState state(config, b);
+	fill([&state](unsigned i, vec3& p, vec3& v) {
+		state.particle(i, p, v);
+	});
+}
+
+template <typename F>
+void SPHoutOfCore::fill(F particle) {
+	// in chunks, the resident set stays small for any number of particles
+	// the order is arbitrary, the first rebinning gathers each slab from all of it
+	const unsigned chunkN = 1<<16;
+	clearBins();
+	for(unsigned first = 0; first < config.particleN; first += chunkN) {
+		unsigned end = std::min(first+chunkN, config.particleN);
+		for(unsigned i = first; i < end; ++i) {
+			vec3 p, v;
+			particle(i, p, v);
+			posOut[i] = p;
+			velOut[i] = v;
+			particleIDOut[i] = i;
+			density[i] = config.Rho0;
+			binOut(i, p);
+		}
+		posOut.release(first, end);
+		velOut.release(first, end);
+		particleIDOut.release(first, end);
+		density.release(first, end);
+		cellOut.release(first, end);
+	}
+}
+
+template <typename Compute, typename Prefetch>
+void SPHoutOfCore::forSlabs(Compute compute, Prefetch prefetch) {
+	const unsigned n = config.SubdivisionN;
+	auto waitBegin = chrono::steady_clock::now();
+	prefetch(0u, std::min(slabLayers, n));
+	ioWaitTime += chrono::duration<float, milli>(chrono::steady_clock::now() - waitBegin).count();
+	for(unsigned x0 = 0; x0 < n; x0 += slabLayers) {
+		unsigned x1 = std::min(x0+slabLayers, n);
+		if(x1 < n)
+			prefetched = async(launch::async, prefetch, x1, std::min(x1+slabLayers, n));
+		compute(x0, x1);
+		if(prefetched.valid()) {
+			waitBegin = chrono::steady_clock::now();
+			prefetched.get();
+			ioWaitTime += chrono::duration<float, milli>(chrono::steady_clock::now() - waitBegin).count();
+		}
+	}
+}
+
+template <typename F>
+void SPHoutOfCore::forNeighbours(unsigned c, F f) const {
+	using std::max;
+	using std::min;
+	const int n = config.SubdivisionN;
+	int cx = c/(n*n), cy = c/n%n, cz = c%n;
+	for(int x = max(0, cx-1); x <= min(n-1, cx+1); ++x)
+		for(int y = max(0, cy-1); y <= min(n-1, cy+1); ++y)
+			for(int z = max(0, cz-1); z <= min(n-1, cz+1); ++z) {
+				const CellRecord& r = cellRecords[(x*n + y)*n + z];
+				for(unsigned j = r.firstParticleID; j < r.firstParticleID+r.particleN; ++j)
+					f(j);
+			}
+}
+
+void SPHoutOfCore::update() {
+	ioBytes = 0;
+	ioWaitTime = 0;
+	rebin();
+	computeDensities();
+	integrate();
+	// the integration keeps the order, the out arrays are in the order of the sorted ones
+	particleID.swap(particleIDOut);
+}
+
+void SPHoutOfCore::computeDensities() {
+	const unsigned layerCellN = config.SubdivisionN*config.SubdivisionN;
+	HealthMetrics& m = health;
+	double errorSum = 0, errorSqSum = 0;
+	if(collectHealth) {
+		m = {};
+		for(const CellRecord& r : cellRecords) {
+			++m.occupancy[occupancyBin(r.particleN)];
+			m.maxOccupancy = std::max(m.maxOccupancy, r.particleN);
+		}
+		m.minDensity = numeric_limits<float>::max();
+		m.maxDensity = numeric_limits<float>::lowest();
+	}
+	forSlabs([&](unsigned x0, unsigned x1) {
+		for(unsigned c = x0*layerCellN; c < x1*layerCellN; ++c) {
+			const CellRecord& r = cellRecords[c];
+			for(unsigned i = r.firstParticleID; i < r.firstParticleID+r.particleN; ++i) {
+				float d = config.M;
+				forNeighbours(c, [&](unsigned j) {
+					vec3 diff = pos[i]-pos[j];
+					d += config.M*w(diff, config.H);
+					if(collectHealth) {
+						++m.candidates;
+						if(length(diff) < config.H)
+							++m.inRange;
+					}
+				});
+				density[i] = d;
+				if(collectHealth) {
+					float e = fabs(d-config.Rho0)/config.Rho0;
+					errorSum += e;
+					errorSqSum += double(e)*e;
+					m.maxDensityError = std::max(m.maxDensityError, e);
+					m.minDensity = std::min(m.minDensity, d);
+					m.maxDensity = std::max(m.maxDensity, d);
+				}
+			}
+		}
+		ioBytes += (windowEnd(x1)-windowFirst(x0))*sizeof(vec3) + (layerFirst(x1)-layerFirst(x0))*sizeof(float);
+		pos.release(windowFirst(x0), windowFirst(x1));
+		density.release(layerFirst(x0), layerFirst(x1));
+	}, [this](unsigned x0, unsigned x1) {
+		pos.prefetch(windowFirst(x0), windowEnd(x1));
+	});
+	if(collectHealth) {
+		m.meanDensityError = errorSum/config.particleN;
+		m.rmsDensityError = sqrt(errorSqSum/config.particleN);
+	}
+}
+
+void SPHoutOfCore::integrate() {
+	const unsigned layerCellN = config.SubdivisionN*config.SubdivisionN;
+	clearBins();
+	forSlabs([&](unsigned x0, unsigned x1) {
+		for(unsigned c = x0*layerCellN; c < x1*layerCellN; ++c) {
+			const CellRecord& r = cellRecords[c];
+			for(unsigned i = r.firstParticleID; i < r.firstParticleID+r.particleN; ++i) {
+				float pressure = config.K*(density[i]-config.Rho0);
+				vec3 fPressure = {};
+				vec3 fViscosity = {};
+				forNeighbours(c, [&](unsigned j) {
+					vec3 d = pos[i]-pos[j];
+					float pressureJ = config.K*(density[j]-config.Rho0);
+					fPressure += config.M*(pressure+pressureJ)/(2*density[j])*wPresure1(d, config.H);
+					fViscosity += (vel[j]-vel[i])*float(config.Mu*config.M/density[j]*wViscosity2(d, config.H));
+				});
+				vec3 fGravity = -UP*9.81f*density[i];
+				vec3 a = (fViscosity + fPressure + fGravity)/density[i];
+				vec3 p = pos[i] + vel[i]*config.Step;
+				vec3 v = vel[i] + a*config.Step;
+				collide(p, v);
+				posOut[i] = p;
+				velOut[i] = v;
+				binOut(i, p);
+			}
+		}
+		unsigned slabN = layerFirst(x1)-layerFirst(x0);
+		ioBytes += (windowEnd(x1)-windowFirst(x0))*(2*sizeof(vec3) + sizeof(float)) + slabN*(2*sizeof(vec3) + sizeof(unsigned));
+		pos.release(windowFirst(x0), windowFirst(x1));
+		vel.release(windowFirst(x0), windowFirst(x1));
+		density.release(windowFirst(x0), windowFirst(x1));
+		posOut.release(layerFirst(x0), layerFirst(x1));
+		velOut.release(layerFirst(x0), layerFirst(x1));
+		cellOut.release(layerFirst(x0), layerFirst(x1));
+	}, [this](unsigned x0, unsigned x1) {
+		unsigned first = windowFirst(x0), end = windowEnd(x1);
+		pos.prefetch(first, end);
+		vel.prefetch(first, end);
+		density.prefetch(first, end);
+	});
+}
+
+void SPHoutOfCore::rebin() {
+	const unsigned n = config.SubdivisionN;
+	const unsigned layerCellN = n*n;
+	// the new grid, binCount becomes the next free position of each cell
+	unsigned first = 0;
+	for(unsigned c = 0; c < cellRecords.size(); ++c) {
+		cellRecords[c] = {first, binCount[c]};
+		binCount[c] = first;
+		first += cellRecords[c].particleN;
+	}
+	for(unsigned x = 0; x < n; ++x)
+		layerFirsts[x] = cellRecords[x*layerCellN].firstParticleID;
+	layerFirsts[n] = config.particleN;
+	// the particles move little in a step, the source range of the slab is about the slab itself
+	forSlabs([&](unsigned x0, unsigned x1) {
+		unsigned sourceFirst, sourceEnd;
+		binSource(x0, x1, sourceFirst, sourceEnd);
+		for(unsigned i = sourceFirst; i < sourceEnd; ++i) {
+			unsigned c = cellOut[i];
+			if(c < x0*layerCellN || c >= x1*layerCellN)
+				continue;
+			unsigned k = binCount[c]++;
+			pos[k] = posOut[i];
+			vel[k] = velOut[i];
+			particleID[k] = particleIDOut[i];
+		}
+		if(sourceFirst < sourceEnd)
+			ioBytes += (sourceEnd-sourceFirst)*(2*sizeof(vec3) + 2*sizeof(unsigned));
+		ioBytes += (layerFirst(x1)-layerFirst(x0))*(2*sizeof(vec3) + sizeof(unsigned));
+		// the source behind the next slab's one
+		unsigned nextFirst = sourceEnd, nextEnd;
+		if(x1 < n)
+			binSource(x1, std::min(x1+slabLayers, n), nextFirst, nextEnd);
+		unsigned releaseEnd = std::min(sourceEnd, nextFirst);
+		posOut.release(sourceFirst, releaseEnd);
+		velOut.release(sourceFirst, releaseEnd);
+		cellOut.release(sourceFirst, releaseEnd);
+		particleIDOut.release(sourceFirst, releaseEnd);
+		pos.release(layerFirst(x0), layerFirst(x1));
+		vel.release(layerFirst(x0), layerFirst(x1));
+		particleID.release(layerFirst(x0), layerFirst(x1));
+	}, [this](unsigned x0, unsigned x1) {
+		unsigned first, end;
+		binSource(x0, x1, first, end);
+		if(first >= end)
+			return;
+		posOut.prefetch(first, end);
+		velOut.prefetch(first, end);
+		cellOut.prefetch(first, end);
+		particleIDOut.prefetch(first, end);
+	});
+}
+
+void SPHoutOfCore::clearBins() {
+	std::fill(binCount.begin(), binCount.end(), 0);
+	std::fill(binSourceFirst.begin(), binSourceFirst.end(), config.particleN);
+	std::fill(binSourceEnd.begin(), binSourceEnd.end(), 0);
+}
+
+void SPHoutOfCore::binOut(unsigned i, const vec3& p) {
+	unsigned c = particlePosToCellID(p);
+	unsigned x = c/(config.SubdivisionN*config.SubdivisionN);
+	cellOut[i] = c;
+	++binCount[c];
+	binSourceFirst[x] = std::min(binSourceFirst[x], i);
+	binSourceEnd[x] = std::max(binSourceEnd[x], i+1);
+}
+
+void SPHoutOfCore::binSource(unsigned x0, unsigned x1, unsigned& first, unsigned& end) const {
+	first = config.particleN;
+	end = 0;
+	for(unsigned x = x0; x < x1; ++x) {
+		first = std::min(first, binSourceFirst[x]);
+		end = std::max(end, binSourceEnd[x]);
+	}
+}
+
+unsigned SPHoutOfCore::particlePosToCellID(const vec3& p) const {
+	vec3 c = (p - b.min) / (b.max - b.min) * float(config.SubdivisionN);
+	// an unstable run may throw the particles out of the bounds (or make them NaN), they must stay in the grid
+	for(int a = 0; a < 3; ++a)
+		c[a] = c[a] >= 0 ? std::min(c[a], float(config.SubdivisionN-1)) : 0;
+	return (unsigned(c.x)*config.SubdivisionN + unsigned(c.y))*config.SubdivisionN + unsigned(c.z);
+}
+
+void SPHoutOfCore::collide(vec3& pos, vec3& vel) {
+	vec3 surfaceNormal;
+	float velL = length(vel);
+	if(b.isOutside(pos, surfaceNormal) && velL > 0 && !isinf(velL)) {
+		pos += -vel*config.Step;
+		vec3 d = -vel/velL;
+		vel = (2*dot(d, surfaceNormal)*surfaceNormal-d)*velL;
+	}
+}
+
+void SPHoutOfCore::getParticles(std::vector<vec3>& pos, std::vector<vec3>& vel) {
+	pos.resize(config.particleN);
+	vel.resize(config.particleN);
+	for(unsigned i = 0; i < config.particleN; ++i) {
+		pos[i] = posOut[i];
+		vel[i] = velOut[i];
+	}
+	posOut.release(0, config.particleN);
+	velOut.release(0, config.particleN);
+}
+
+void SPHoutOfCore::setParticles(const std::vector<vec3>& pos, const std::vector<vec3>& vel) {
+	fill([&](unsigned i, vec3& p, vec3& v) {
+		p = pos[i];
+		v = vel[i];
+	});
+}
+
+void SPHoutOfCore::getParticleIDs(std::vector<unsigned>& id) {
+	id.resize(config.particleN);
+	for(unsigned i = 0; i < config.particleN; ++i)
+		id[i] = particleIDOut[i];
+	particleIDOut.release(0, config.particleN);
+}
+
+void SPHoutOfCore::getDensities(std::vector<float>& density) {
+	density.resize(config.particleN);
+	for(unsigned i = 0; i < config.particleN; ++i)
+		density[i] = this->density[i];
+	this->density.release(0, config.particleN);
+}
+
+void SPHoutOfCore::getCellRecords(std::vector<CellRecord>& cellRecords) {
+	cellRecords = this->cellRecords;
+}
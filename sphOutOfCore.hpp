@@ -0,0 +1,121 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       sphOutOfCore.hpp
+ * \author     Ales Koblizek
+ * \date       2026/10/19
+ * \brief      CPU implementation of SPH for particle sets larger than the memory
+*/
+//----------------------------------------------------------------------------------------
+#ifndef SPHOUTOFCORE_HPP_26_10_19_18_04_22
+#define SPHOUTOFCORE_HPP_26_10_19_18_04_22
+#include <future>
+#include <string>
+#include <utility>
+#include "sph.hpp"
+
+/// byte range of a memory mapping: the pages are read ahead and faulted in (waits for the reads)
+void prefetchPages(void* data, size_t begin, size_t end);
+/// byte range of a shared file mapping: the pages leave the resident set, the modified ones stay in the file
+void releasePages(void* data, size_t begin, size_t end);
+
+/// Array of n elements in a memory-mapped temporary file, the file is unlinked at once and its space freed with the array
+template <typename T>
+class MappedArray {
+	public:
+		MappedArray(): data{nullptr}, n{0} {}
+		~MappedArray();
+		MappedArray(const MappedArray&) = delete;
+		MappedArray& operator=(const MappedArray&) = delete;
+
+		/// creates the file in the directory dir and maps it, the elements are zero
+		bool create(const std::string& dir, size_t n);
+		T& operator[](size_t i) { return data[i]; }
+		const T& operator[](size_t i) const { return data[i]; }
+		void prefetch(size_t first, size_t end) { prefetchPages(data, first*sizeof(T), end*sizeof(T)); }
+		void release(size_t first, size_t end) { releasePages(data, first*sizeof(T), end*sizeof(T)); }
+		void swap(MappedArray& other) { std::swap(data, other.data); std::swap(n, other.n); }
+
+	private:
+		T* data;
+		size_t n;
+};
+
+/* WCSPH (the same physics as SPHcpu::updateWcsph) on the particle data kept in memory-mapped files
+ * in config.OutOfCoreDir, sorted by the cells of the neighbour-search grid.
+ * The cell ID grows with x first, so a slab of config.SlabLayers cell layers along x is a contiguous range of the particles,
+ * the neighbours of its particles are within the slab and one layer (the cells are at least H wide) on each side.
+ * Each pass of the step streams through the slabs, only the window of the slab with its halo is resident,
+ * the window of the next slab is prefetched by another thread meanwhile:
+ *   rebinning: the state of the last step is sorted into its cells slab by slab, the particles move at most a layer or so
+ *     per step, so the new slab gathers them from a little more than the same range of the old order
+ *   densities: the positions of the window -> the densities of the slab
+ *   integration: the positions, velocities and densities of the window -> the new state of the slab and its new cells
+ * Only the grid (a few words per cell) is kept in the memory.
+ * Does not draw, the particle positions are never all in the memory.
+ */
+class SPHoutOfCore: public SPH {
+	public:
+		SPHoutOfCore(SPHconfig &config, Bounds& _b);
+		void reset() override;
+		void update() override;
+		/// the whole particle set in the memory, for the comparisons and small runs
+		void getParticles(std::vector<vec3>& pos, std::vector<vec3>& vel) override;
+		void setParticles(const std::vector<vec3>& pos, const std::vector<vec3>& vel) override;
+		void getParticleIDs(std::vector<unsigned>& id) override;
+		void getDensities(std::vector<float>& density) override;
+		void getCellRecords(std::vector<CellRecord>& cellRecords) override;
+
+	private:
+		/* Calls compute(x0, x1) for each slab of the cell layers [x0, x1) in turn,
+		 * the layers [x1, x1+SlabLayers) of the next slab are passed to prefetch on another thread in the meantime.
+		 */
+		template <typename Compute, typename Prefetch>
+		void forSlabs(Compute compute, Prefetch prefetch);
+		/// first particle of the layer x, the particles of the layers [x0, x1) are [layerFirst(x0), layerFirst(x1))
+		unsigned layerFirst(unsigned x) const { return layerFirsts[x]; }
+		/// the particles of the slab [x0, x1) and of the layer of halo on each side (no particles for x0 == SubdivisionN)
+		unsigned windowFirst(unsigned x0) const { return layerFirsts[x0 > 0 && x0 < config.SubdivisionN ? x0-1 : x0]; }
+		unsigned windowEnd(unsigned x1) const { return layerFirsts[std::min(x1+1, config.SubdivisionN)]; }
+		/// calls f(j) for each particle j of the 27 cells around the cell c
+		template <typename F>
+		void forNeighbours(unsigned c, F f) const;
+		void computeDensities();
+		/// forces, integration and the collisions into posOut and velOut, the new cells of the particles into cellOut
+		void integrate();
+		/// sorts posOut and velOut by cellOut into pos and vel, rebuilds the grid
+		void rebin();
+		/// new state from particle(i, pos, vel) for each particle i, sorted by the next step
+		template <typename F>
+		void fill(F particle);
+		/// the particles of the out arrays are about to be binned
+		void clearBins();
+		/// the particle i of the out arrays is at p
+		void binOut(unsigned i, const vec3& p);
+		/// range of the out arrays holding the particles binned to the layers [x0, x1), empty if first >= end
+		void binSource(unsigned x0, unsigned x1, unsigned& first, unsigned& end) const;
+		unsigned particlePosToCellID(const vec3& p) const;
+		/// reflects the particle leaving the bounds, as SPHcpu::collide
+		void collide(vec3& pos, vec3& vel);
+
+	private:
+		unsigned slabLayers;
+		// the state at the start of the step in the order of the cell records
+		MappedArray<vec3> pos;
+		MappedArray<vec3> vel;
+		MappedArray<float> density;
+		MappedArray<unsigned> particleID; /// index of the particle in the last reset or setParticles
+		// the state after the step in the same order
+		MappedArray<vec3> posOut;
+		MappedArray<vec3> velOut;
+		MappedArray<unsigned> cellOut;
+		MappedArray<unsigned> particleIDOut;
+
+		std::vector<CellRecord> cellRecords;
+		std::vector<unsigned> layerFirsts; /// SubdivisionN+1 values
+		std::vector<unsigned> binCount; /// particles of the out arrays per cell, then the next free position of the cell during the rebinning
+		std::vector<unsigned> binSourceFirst; /// per layer, range of the out arrays holding the particles of the layer
+		std::vector<unsigned> binSourceEnd;
+		std::future<void> prefetched;
+};
+
+#endif /* SPHOUTOFCORE_HPP_26_10_19_18_04_22 */
@@ -0,0 +1,107 @@
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <limits>
+#include "sphRegistry.hpp"
+using namespace std;
+
+SPHregistry& SPHregistry::instance() {
+	static SPHregistry registry;
+	return registry;
+}
+
+void SPHregistry::add(const std::string& name, SPHfactory factory, SPHcapabilities capabilities) {
+	factories[name] = {factory, capabilities};
+}
+
+vector<string> SPHregistry::names() const {
+	vector<string> r;
+	for(const auto& f : factories)
+		r.push_back(f.first);
+	return r;
+}
+
+const SPHcapabilities* SPHregistry::capabilities(const std::string& name) const {
+	auto f = factories.find(name);
+	return f == factories.end() ? nullptr : &f->second.capabilities;
+}
+
+unique_ptr<SPH> SPHregistry::create(const std::string& name, SPHconfig& config, Bounds& b, bool drawing, std::string* resolvedName) {
+	if(name == "auto")
+		return createFastest(config, b, drawing, resolvedName);
+	auto f = factories.find(name);
+	if(f == factories.end())
+		return nullptr;
+	if(resolvedName)
+		*resolvedName = name;
+	return f->second.factory(config, b);
+}
+
+unique_ptr<SPH> SPHregistry::createFastest(SPHconfig& config, Bounds& b, bool drawing, std::string* resolvedName) {
+	string key = probeKey(config, b, drawing);
+	string cached = loadProbeResult(key);
+	if(factories.count(cached)) {
+		cout << "Using cached backend choice: " << cached << endl;
+		return create(cached, config, b, drawing, resolvedName);
+	}
+
+	const unsigned warmupStepN = 2;
+	const unsigned measuredStepN = 5;
+	unique_ptr<SPH> fastest;
+	string fastestName;
+	double fastestTime = numeric_limits<double>::max();
+	for(const auto& f : factories) {
+		const SPHcapabilities& c = f.second.capabilities;
+		if(!c.probed || (drawing && !c.draws))
+			continue;
+		unique_ptr<SPH> sph = f.second.factory(config, b);
+		for(unsigned i = 0; i < warmupStepN; ++i)
+			sph->update();
+		glFinish();
+		auto begin = chrono::steady_clock::now();
+		for(unsigned i = 0; i < measuredStepN; ++i)
+			sph->update();
+		glFinish();
+		double t = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count()/measuredStepN;
+		cout << "Backend probe " << f.first << ": " << t << " ms/step\n";
+		if(t < fastestTime) {
+			fastestTime = t;
+			fastestName = f.first;
+			fastest = move(sph);
+		}
+	}
+	if(!fastest)
+		return nullptr;
+	cout << "Using the fastest backend: " << fastestName << endl;
+	storeProbeResult(key, fastestName);
+	if(resolvedName)
+		*resolvedName = fastestName;
+	fastest->reset();
+	return fastest;
+}
+
+string SPHregistry::probeKey(const SPHconfig& config, const Bounds& b, bool drawing) {
+	ostringstream key;
+	key << hex << hashString(driverString()) << dec << "_" << config.particleN << "_" << config.SubdivisionN
+		<< "_" << int(config.Solver) << "_" << config.H << "_" << config.IncrementalRebinning << config.LazyReorder
+		<< config.TiledTraversal << config.LocalTimeStepping << bool(b.obstacles) << drawing;
+	return key.str();
+}
+
+string SPHregistry::loadProbeResult(const std::string& probeKey) {
+	if(getProgramBinaryCacheDir().empty())
+		return {};
+	ifstream f(getProgramBinaryCacheDir() + "/backends.txt");
+	string key, name;
+	while(f >> key >> name)
+		if(key == probeKey)
+			return name;
+	return {};
+}
+
+void SPHregistry::storeProbeResult(const std::string& key, const std::string& name) {
+	if(getProgramBinaryCacheDir().empty())
+		return;
+	ofstream f(getProgramBinaryCacheDir() + "/backends.txt", ios::app);
+	f << key << " " << name << "\n";
+}
@@ -0,0 +1,62 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       sphRegistry.hpp
+ * \author     Ales Koblizek
+ * \date       2026/10/19
+ * \brief      Registry of SPH implementations selectable at runtime
+*/
+//----------------------------------------------------------------------------------------
+#ifndef SPHREGISTRY_HPP_26_10_19_10_31_48
+#define SPHREGISTRY_HPP_26_10_19_10_31_48 
+#include <functional>
+#include <memory>
+#include <map>
+#include "sph.hpp"
+
+using SPHfactory = std::function<std::unique_ptr<SPH>(SPHconfig&, Bounds&)>;
+
+/// What the implementation can do, "auto" picks only among the suitable ones
+struct SPHcapabilities {
+	bool draws = true; /// keeps the particle positions in the vertex buffer of SPH, required by the interactive mode
+	bool probed = true; /// takes part in the "auto" probe (not the implementations with side effects such as the files of SPHoutOfCore)
+};
+
+/// SPH implementations by name, the implementations register themselves using SPHregistration
+class SPHregistry {
+	public:
+		static SPHregistry& instance();
+
+		void add(const std::string& name, SPHfactory factory, SPHcapabilities capabilities = {});
+		std::vector<std::string> names() const;
+		/// \return nullptr if there is no implementation of the name
+		const SPHcapabilities* capabilities(const std::string& name) const;
+		/* \return nullptr if there is no implementation of the name
+		 * "auto" runs a short probe of the probed implementations (only the drawing ones if drawing is set) and picks the fastest one,
+		 * the decision is cached. resolvedName (if given) is set to the name of the created implementation.
+		 */
+		std::unique_ptr<SPH> create(const std::string& name, SPHconfig& config, Bounds& b, bool drawing = false, std::string* resolvedName = nullptr);
+
+	private:
+		struct Entry {
+			SPHfactory factory;
+			SPHcapabilities capabilities;
+		};
+
+		std::unique_ptr<SPH> createFastest(SPHconfig& config, Bounds& b, bool drawing, std::string* resolvedName);
+		/// the probe result holds only for the same device, problem size, solver, kernel radius and optimizations
+		std::string probeKey(const SPHconfig& config, const Bounds& b, bool drawing);
+		std::string loadProbeResult(const std::string& key);
+		void storeProbeResult(const std::string& key, const std::string& name);
+
+	private:
+		std::map<std::string, Entry> factories;
+};
+
+/// Registers the implementation during static initialization, to be defined in the implementation's source file
+struct SPHregistration {
+	SPHregistration(const std::string& name, SPHfactory factory, SPHcapabilities capabilities = {}) {
+		SPHregistry::instance().add(name, factory, capabilities);
+	}
+};
+
+#endif /* SPHREGISTRY_HPP_26_10_19_10_31_48 */
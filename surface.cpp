@@ -0,0 +1,355 @@
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include "surface.hpp"
+using namespace std;
+
+/// cube edge between the corners a and b (they differ in a single coordinate)
+static int cubeEdge(unsigned a, unsigned b) {
+	unsigned lo = std::min(a, b);
+	switch(a^b) {
+		case 1: return (lo>>1)&3; // along x, indexed by y, z
+		case 2: return 4 + ((lo&1) | ((lo>>2)&1)<<1); // along y, indexed by x, z
+		default: return 8 + (lo&3); // along z, indexed by x, y
+	}
+}
+
+static vec3 cubeCorner(unsigned c) {
+	return vec3(c&1, (c>>1)&1, (c>>2)&1);
+}
+
+static vec3 cubeEdgeMidpoint(int e) {
+	for(unsigned a = 0; a < 8; ++a)
+		for(unsigned d = 1; d < 8; d *= 2)
+			if(!(a & d) && cubeEdge(a, a|d) == e)
+				return (cubeCorner(a) + cubeCorner(a|d))*0.5f;
+	return {};
+}
+
+static vector<int> generateMarchingCubesTable() {
+	// the faces as cycles of corners, counterclockwise seen from outside the cube
+	vector<array<unsigned,4>> faces;
+	for(unsigned axis = 0; axis < 3; ++axis)
+		for(unsigned side = 0; side < 2; ++side) {
+			unsigned a = 1<<axis, u = 1<<((axis+1)%3), v = 1<<((axis+2)%3);
+			unsigned base = side ? a : 0;
+			array<unsigned,4> f = {base, base|u, base|u|v, base|v};
+			vec3 n = cubeCorner(a)*(side ? 1.f : -1.f);
+			vec3 p0 = cubeCorner(f[0]), p1 = cubeCorner(f[1]), p2 = cubeCorner(f[2]);
+			if(dot(cross(p1-p0, p2-p1), n) < 0)
+				swap(f[1], f[3]);
+			faces.push_back(f);
+		}
+
+	vector<int> table(256*MarchingCubesRow, -1);
+	bool flip = false;
+	for(unsigned orientationPass = 0; orientationPass < 2; ++orientationPass)
+		for(unsigned cubeCase = 0; cubeCase < 256; ++cubeCase) {
+			auto inside = [cubeCase](unsigned c) { return bool(cubeCase & (1u<<c)); };
+			// on every face the surface leaves the inside region at an exit edge and closes it at the preceding entry edge,
+			// each crossed edge is an exit on one of its faces and an entry on the other one - the segments chain into loops
+			int next[12];
+			fill(next, next+12, -1);
+			for(const array<unsigned,4>& f : faces)
+				for(unsigned k = 0; k < 4; ++k) {
+					if(!(inside(f[k]) && !inside(f[(k+1)%4])))
+						continue;
+					for(unsigned m = 3; m >= 1; --m) {
+						unsigned p = (k+m)%4;
+						if(!inside(f[p]) && inside(f[(p+1)%4])) {
+							next[cubeEdge(f[k], f[(k+1)%4])] = cubeEdge(f[p], f[(p+1)%4]);
+							break;
+						}
+					}
+				}
+			int* row = &table[cubeCase*MarchingCubesRow];
+			unsigned rowN = 0;
+			bool visited[12] = {};
+			for(int start = 0; start < 12; ++start) {
+				if(next[start] < 0 || visited[start])
+					continue;
+				vector<int> loop;
+				for(int e = start; !visited[e]; e = next[e]) {
+					visited[e] = true;
+					loop.push_back(e);
+				}
+				// fan triangulation
+				for(unsigned i = 1; i+1 < loop.size(); ++i) {
+					int t[3] = {loop[0], loop[i], loop[i+1]};
+					if(flip)
+						swap(t[1], t[2]);
+					if(rowN+3 >= MarchingCubesRow) {
+						cerr << "Marching cubes case " << cubeCase << " has too many triangles\n";
+						break;
+					}
+					copy(t, t+3, row+rowN);
+					rowN += 3;
+				}
+			}
+			// the normals of the triangles should point out of the fluid - away from the single inside corner 0
+			if(orientationPass == 0 && cubeCase == 1) {
+				vec3 p0 = cubeEdgeMidpoint(row[0]), p1 = cubeEdgeMidpoint(row[1]), p2 = cubeEdgeMidpoint(row[2]);
+				flip = dot(cross(p1-p0, p2-p0), (p0+p1+p2)/3.f - cubeCorner(0)) < 0;
+				break;
+			}
+		}
+	return table;
+}
+
+const std::vector<int>& marchingCubesTable() {
+	static const vector<int> table = generateMarchingCubesTable();
+	return table;
+}
+
+std::vector<unsigned> surfaceCells(const std::vector<CellRecord>& cellRecords, unsigned subdivisionN) {
+	const int n = subdivisionN;
+	vector<unsigned char> marked(cellRecords.size(), 0);
+	for(int x = 0; x < n; ++x)
+		for(int y = 0; y < n; ++y)
+			for(int z = 0; z < n; ++z) {
+				if(cellRecords[(x*n + y)*n + z].particleN == 0)
+					continue;
+				for(int nx = std::max(x-1, 0); nx <= std::min(x+1, n-1); ++nx)
+					for(int ny = std::max(y-1, 0); ny <= std::min(y+1, n-1); ++ny)
+						for(int nz = std::max(z-1, 0); nz <= std::min(z+1, n-1); ++nz)
+							marked[(nx*n + ny)*n + nz] = 1;
+			}
+	vector<unsigned> cells;
+	for(unsigned c = 0; c < marked.size(); ++c)
+		if(marked[c])
+			cells.push_back(c);
+	return cells;
+}
+
+namespace {
+/* The field at the nodes of the voxels. Every node is sampled once, by the cell which has it at its lower corner
+ * (by the last cell along the axes where it lies on the upper bound), so the voxels of the neighbour cells
+ * share the node values and the mesh has no cracks even though the grid is from the last step.
+ */
+struct SurfaceField {
+	int n; /// grid subdivision
+	unsigned s; /// samples per cell
+	vector<unsigned> slot; /// block of the sampled nodes of each cell, ~0u if not sampled
+	vector<vec4> nodes; /// gradient and value, (s+1)^3 per sampled cell
+
+	unsigned blockSize() const { return (s+1)*(s+1)*(s+1); }
+	unsigned owner(unsigned g) const { return std::min(g/s, unsigned(n-1)); }
+	/// node (gx, gy, gz) of the global node grid of (n*s+1)^3 nodes
+	const vec4& at(unsigned gx, unsigned gy, unsigned gz) const {
+		unsigned x = owner(gx), y = owner(gy), z = owner(gz);
+		unsigned s1 = s+1;
+		return nodes[slot[(x*n + y)*n + z]*blockSize() + ((gx - x*s)*s1 + gy - y*s)*s1 + gz - z*s];
+	}
+};
+
+/// scratch of one extraction thread
+struct SurfaceWorker {
+	vector<unsigned> candidates; /// particles of the 27 neighbour cells
+	SurfaceMesh mesh;
+};
+}
+
+static vec3 nodePosition(const Bounds& b, vec3 cellSize, unsigned s, unsigned gx, unsigned gy, unsigned gz) {
+	return b.min + vec3(gx, gy, gz)/float(s)*cellSize;
+}
+
+/// samples the colour field and its gradient at the nodes owned by the cell
+static void sampleCell(unsigned cell, const SPHconfig& config, const Bounds& b, const vector<vec3>& pos,
+		const vector<float>& density, const vector<CellRecord>& cellRecords, SurfaceField& field, SurfaceWorker& worker) {
+	const int n = field.n;
+	const unsigned s = field.s;
+	const int x = cell/(n*n), y = (cell/n)%n, z = cell%n;
+	const vec3 cellSize = (b.max - b.min)/float(n);
+
+	// the particles in range of the nodes of the cell, in the order of their index
+	worker.candidates.clear();
+	for(int nx = std::max(x-1, 0); nx <= std::min(x+1, n-1); ++nx)
+		for(int ny = std::max(y-1, 0); ny <= std::min(y+1, n-1); ++ny)
+			for(int nz = std::max(z-1, 0); nz <= std::min(z+1, n-1); ++nz) {
+				const CellRecord& r = cellRecords[(nx*n + ny)*n + nz];
+				for(unsigned j = r.firstParticleID; j < r.firstParticleID+r.particleN; ++j)
+					worker.candidates.push_back(j);
+			}
+
+	// poly6 and its gradient
+	const float h = config.H;
+	const float h2 = h*h;
+	const float wK = 315.f/(64.f*M_PI*pow(h, 9.f));
+	const float gradK = -945.f/(32.f*M_PI*pow(h, 9.f));
+	const unsigned s1 = s+1;
+	vec4* nodes = &field.nodes[field.slot[cell]*field.blockSize()];
+	// the upper layer of nodes belongs to the next cell, except on the upper bound
+	const unsigned iN = x+1 == n ? s1 : s, jN = y+1 == n ? s1 : s, kN = z+1 == n ? s1 : s;
+	for(unsigned i = 0; i < iN; ++i)
+		for(unsigned j = 0; j < jN; ++j)
+			for(unsigned k = 0; k < kN; ++k) {
+				vec3 p = nodePosition(b, cellSize, s, x*s + i, y*s + j, z*s + k);
+				vec4 f(0);
+				for(unsigned c : worker.candidates) {
+					vec3 r = p - pos[c];
+					float q = h2 - dot(r, r);
+					if(q <= 0)
+						continue;
+					float v = config.M/density[c];
+					f += vec4(r*(v*gradK*q*q), v*wK*q*q*q);
+				}
+				nodes[(i*s1 + j)*s1 + k] = f;
+			}
+}
+
+/// appends the triangles of the voxels of the cell to the mesh of the worker
+static void polygonizeCell(unsigned cell, const SurfaceConfig& sc, const Bounds& b, const SurfaceField& field, SurfaceWorker& worker) {
+	const int n = field.n;
+	const unsigned s = field.s;
+	const unsigned x = cell/(n*n), y = (cell/n)%n, z = cell%n;
+	const vec3 cellSize = (b.max - b.min)/float(n);
+	const vector<int>& table = marchingCubesTable();
+	for(unsigned i = x*s; i < (x+1)*s; ++i)
+		for(unsigned j = y*s; j < (y+1)*s; ++j)
+			for(unsigned k = z*s; k < (z+1)*s; ++k) {
+				vec4 corner[8];
+				unsigned cubeCase = 0;
+				for(unsigned c = 0; c < 8; ++c) {
+					corner[c] = field.at(i + (c&1), j + ((c>>1)&1), k + ((c>>2)&1));
+					if(corner[c].w > sc.isoLevel)
+						cubeCase |= 1u<<c;
+				}
+				if(cubeCase == 0 || cubeCase == 255)
+					continue;
+				for(const int* e = &table[cubeCase*MarchingCubesRow]; *e >= 0; ++e) {
+					// the corners of the edge
+					unsigned a, d;
+					if(*e < 4) {
+						a = (*e&3)<<1;
+						d = 1;
+					}
+					else if(*e < 8) {
+						a = ((*e-4)&1) | (((*e-4)>>1)<<2);
+						d = 2;
+					}
+					else {
+						a = *e-8;
+						d = 4;
+					}
+					vec4 fa = corner[a], fb = corner[a|d];
+					float t = (sc.isoLevel - fa.w)/(fb.w - fa.w);
+					vec3 pa = nodePosition(b, cellSize, s, i + (a&1), j + ((a>>1)&1), k + ((a>>2)&1));
+					vec3 pb = nodePosition(b, cellSize, s, i + ((a|d)&1), j + (((a|d)>>1)&1), k + (((a|d)>>2)&1));
+					vec3 g = mix(vec3(fa), vec3(fb), t);
+					worker.mesh.vertices.push_back(mix(pa, pb, t));
+					worker.mesh.normals.push_back(length(g) > 0 ? -normalize(g) : vec3(0, 1, 0));
+				}
+			}
+}
+
+/// runs work(cell, worker) on threadN threads, each over a contiguous range of the cells
+template<typename Work>
+static void forCells(const vector<unsigned>& cells, vector<SurfaceWorker>& workers, Work work) {
+	const unsigned threadN = workers.size();
+	auto range = [&](unsigned t) {
+		for(size_t c = cells.size()*t/threadN; c < cells.size()*(t+1)/threadN; ++c)
+			work(cells[c], workers[t]);
+	};
+	vector<thread> threads;
+	for(unsigned t = 1; t < threadN; ++t)
+		threads.emplace_back(range, t);
+	range(0);
+	for(thread& t : threads)
+		t.join();
+}
+
+void extractSurface(const SurfaceConfig& sc, const SPHconfig& config, const Bounds& b, const std::vector<vec3>& pos,
+		const std::vector<float>& density, const std::vector<CellRecord>& cellRecords, SurfaceMesh& mesh) {
+	const int n = config.SubdivisionN;
+	vector<unsigned> cells = surfaceCells(cellRecords, n);
+
+	// the nodes of the voxels of a cell are owned by the cell and by its upper neighbours
+	SurfaceField field{n, std::max(1u, sc.samplesPerCell), vector<unsigned>(cellRecords.size(), ~0u), {}};
+	vector<unsigned char> sampled(cellRecords.size(), 0);
+	for(unsigned cell : cells) {
+		int x = cell/(n*n), y = (cell/n)%n, z = cell%n;
+		for(int nx = x; nx <= std::min(x+1, n-1); ++nx)
+			for(int ny = y; ny <= std::min(y+1, n-1); ++ny)
+				for(int nz = z; nz <= std::min(z+1, n-1); ++nz)
+					sampled[(nx*n + ny)*n + nz] = 1;
+	}
+	vector<unsigned> sampledCells;
+	for(unsigned c = 0; c < sampled.size(); ++c)
+		if(sampled[c]) {
+			field.slot[c] = sampledCells.size();
+			sampledCells.push_back(c);
+		}
+	field.nodes.resize(sampledCells.size()*field.blockSize());
+
+	unsigned threadN = sc.threadN ? sc.threadN : std::max(1u, thread::hardware_concurrency());
+	threadN = std::max(1u, std::min<unsigned>(threadN, cells.size()));
+	// contiguous ranges of the cells, so that the triangle order does not depend on the timing
+	vector<SurfaceWorker> workers(threadN);
+	forCells(sampledCells, workers, [&](unsigned cell, SurfaceWorker& w) {
+		sampleCell(cell, config, b, pos, density, cellRecords, field, w);
+	});
+	forCells(cells, workers, [&](unsigned cell, SurfaceWorker& w) {
+		polygonizeCell(cell, sc, b, field, w);
+	});
+
+	mesh.vertices.clear();
+	mesh.normals.clear();
+	for(const SurfaceWorker& w : workers) {
+		mesh.vertices.insert(mesh.vertices.end(), w.mesh.vertices.begin(), w.mesh.vertices.end());
+		mesh.normals.insert(mesh.normals.end(), w.mesh.normals.begin(), w.mesh.normals.end());
+	}
+}
+
+bool writeObj(const std::string& file, const SurfaceMesh& mesh) {
+	ofstream f(file);
+	if(!f)
+		return false;
+	f << "# fluid surface, " << mesh.vertices.size()/3 << " triangles\n";
+	for(const vec3& v : mesh.vertices)
+		f << "v " << v.x << " " << v.y << " " << v.z << "\n";
+	for(const vec3& n : mesh.normals)
+		f << "vn " << n.x << " " << n.y << " " << n.z << "\n";
+	for(size_t i = 1; i+2 <= mesh.vertices.size(); i += 3)
+		f << "f " << i << "//" << i << " " << i+1 << "//" << i+1 << " " << i+2 << "//" << i+2 << "\n";
+	return bool(f);
+}
+
+SurfaceWriter::SurfaceWriter(const std::string& _dir, unsigned _period, const SurfaceConfig& _sc):
+	dir{_dir}, period{_period ? _period : 1}, sc{_sc}, frameN{0}, meshingTime{0}, writeTime{0}, triangleN{0}
+{
+	error_code ec;
+	filesystem::create_directories(dir, ec);
+	log.open(dir + "/meshing.csv");
+	log << "step,triangles,meshing_ms,write_ms\n";
+}
+
+void SurfaceWriter::write(SPH& sph, unsigned step) {
+	auto begin = chrono::steady_clock::now();
+	sph.extractSurface(sc, mesh);
+	auto meshed = chrono::steady_clock::now();
+	ostringstream file;
+	file << dir << "/surface_" << setw(6) << setfill('0') << step << ".obj";
+	if(!writeObj(file.str(), mesh))
+		cerr << "Could not write " << file.str() << endl;
+	double tMesh = chrono::duration<double, milli>(meshed - begin).count();
+	double tWrite = chrono::duration<double, milli>(chrono::steady_clock::now() - meshed).count();
+	log << step << "," << mesh.vertices.size()/3 << "," << tMesh << "," << tWrite << "\n";
+	++frameN;
+	meshingTime += tMesh;
+	writeTime += tWrite;
+	triangleN += mesh.vertices.size()/3;
+}
+
+void SurfaceWriter::report(std::ostream& s) const {
+	if(frameN == 0)
+		return;
+	s << "meshed frames: " << frameN << "\n"
+		<< "avg meshing time: " << meshingTime/frameN << " [ms]\n"
+		<< "avg triangles: " << triangleN/frameN << "\n"
+		<< "avg OBJ write time: " << writeTime/frameN << " [ms]\n";
+}
@@ -0,0 +1,74 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       surface.hpp
+ * \author     Ales Koblizek
+ * \date       2026/10/19
+ * \brief      Fluid surface mesh - marching cubes on the neighbour-search grid
+*/
+//----------------------------------------------------------------------------------------
+#ifndef SURFACE_HPP_26_10_19_16_02_41
+#define SURFACE_HPP_26_10_19_16_02_41
+#include <fstream>
+#include <string>
+#include "sph.hpp"
+
+/// triangle soup of the fluid surface, three vertices per triangle
+struct SurfaceMesh {
+	std::vector<vec3> vertices;
+	std::vector<vec3> normals; /// per vertex, pointing out of the fluid
+};
+
+/* The surface is the isosurface of the colour field c(x) = sum_j M/density_j W(x-x_j, H) (about 1 inside the fluid).
+ * Each cell of the neighbour-search grid is split into samplesPerCell^3 marching cubes voxels, the field at their nodes
+ * needs only the particles of the 27 neighbour cells. The field vanishes farther than H from the particles,
+ * so only the cells next to the occupied ones are polygonized. The surface is open where the fluid touches the bounds.
+ */
+struct SurfaceConfig {
+	unsigned samplesPerCell = 4; /// voxels along each edge of a grid cell
+	float isoLevel = 0.5;
+	unsigned threadN = 0; /// CPU extraction, 0 - all the hardware threads
+};
+
+/* Marching cubes case table: triangles (as triples of cube edges) of each of the 256 corner configurations,
+ * terminated by -1. Bit i of the case is set if corner i is inside (field > isoLevel); corner i is at
+ * (i&1, (i>>1)&1, (i>>2)&1), edges 0-3 go along x, 4-7 along y, 8-11 along z.
+ * The table is generated from the face rules, the ambiguous faces always separate the inside corners,
+ * so the neighbouring voxels agree and the mesh has no cracks.
+ */
+const std::vector<int>& marchingCubesTable();
+static const unsigned MarchingCubesRow = 16; /// ints per case in marchingCubesTable (at most 5 triangles and -1)
+
+/// the cells of the grid which may contain the surface - the occupied ones and their 26 neighbours
+std::vector<unsigned> surfaceCells(const std::vector<CellRecord>& cellRecords, unsigned subdivisionN);
+
+/// CPU extraction from the particles and the grid of SPH::getParticles, getDensities and getCellRecords, in parallel
+void extractSurface(const SurfaceConfig& sc, const SPHconfig& config, const Bounds& b, const std::vector<vec3>& pos,
+		const std::vector<float>& density, const std::vector<CellRecord>& cellRecords, SurfaceMesh& mesh);
+
+/// Wavefront OBJ with the vertex normals
+bool writeObj(const std::string& file, const SurfaceMesh& mesh);
+
+/// meshes every period-th step into dir/surface_<step>.obj, the meshing time of each frame goes to dir/meshing.csv
+class SurfaceWriter {
+	public:
+		SurfaceWriter(const std::string& dir, unsigned period, const SurfaceConfig& sc);
+		bool valid() const { return bool(log); }
+		/// \return true if the step (counted from 0) should be meshed
+		bool due(unsigned step) const { return step % period == 0; }
+		void write(SPH& sph, unsigned step);
+		/// average meshing time, triangle count and OBJ write time
+		void report(std::ostream& s) const;
+
+	private:
+		std::string dir;
+		unsigned period;
+		SurfaceConfig sc;
+		SurfaceMesh mesh;
+		std::ofstream log;
+		unsigned frameN;
+		double meshingTime; /// [ms] summed over the frames
+		double writeTime;
+		unsigned long long triangleN;
+};
+
+#endif /* SURFACE_HPP_26_10_19_16_02_41 */
@@ -0,0 +1,281 @@
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include "sweep.hpp"
+#include "sphEnsemble.hpp"
+using namespace std;
+
+/// updates the density error and the NaN flag of the result, fastN is the number of the particles faster than speedLimit
+/// \return sum of the compression of the particles
+static double checkState(const vector<vec3>& pos, const vector<vec3>& vel, const vector<float>& density, float rho0, float speedLimit, RunResult& r, unsigned& fastN) {
+	double compression = 0;
+	fastN = 0;
+	for(unsigned p = 0; p < pos.size(); ++p) {
+		if(!(length(vel[p]) <= speedLimit))
+			++fastN;
+		float e = (density[p]-rho0)/rho0;
+		r.maxDensityError = std::max(r.maxDensityError, fabs(e));
+		compression += std::max(0.f, e);
+		if(!isfinite(density[p]) || !isfinite(pos[p].x+pos[p].y+pos[p].z) || !isfinite(vel[p].x+vel[p].y+vel[p].z))
+			r.nan = true;
+	}
+	return compression;
+}
+
+/// particles thrown faster than the free fall over the height of the box are still being pushed apart by the initial overlaps
+static float settledSpeed(const Bounds& b) {
+	return sqrt(2*9.81f*(b.max.y-b.min.y));
+}
+
+/// the run is settled from the first sampled step after the last one with more than 1 % of too fast particles
+/// (a few splashes at the walls do not count)
+static void updateSettling(RunResult& r, unsigned fastN, unsigned particleN, double stepTime) {
+	if(fastN > particleN/100)
+		r.settledStepN = 0;
+	else if(r.settledStepN == 0) {
+		r.settledStepN = r.stepN;
+		r.settleTime = r.initTime/1000 + stepTime;
+	}
+}
+
+RunResult runHeadless(SPH& sph, const SPHconfig& config, const Bounds& b, unsigned stepN, unsigned sampling, SharedStateWriter* exporter, HealthLog* healthLog, SurfaceWriter* surfaceWriter) {
+	RunResult r{0, 0, 0, 0, 0, false, 0, 0, 0};
+	vector<vec3> pos, vel;
+	vector<float> density;
+	auto initBegin = chrono::steady_clock::now();
+	sph.reset();
+	glFinish();
+	r.initTime = chrono::duration<float, milli>(chrono::steady_clock::now() - initBegin).count();
+	const float speedLimit = settledSpeed(b);
+	double stepTime = 0;
+	double compression = 0;
+	unsigned long long sampleN = 0;
+	for(unsigned i = 0; i < stepN && !r.nan; ++i) {
+		sph.collectHealth = healthLog && healthLog->due(i);
+		auto begin = chrono::steady_clock::now();
+		sph.update();
+		glFinish();
+		double t = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+		stepTime += t;
+		if(sph.collectHealth)
+			healthLog->record(i, t*1000, sph.health);
+		// the meshing is not counted in the step time
+		if(surfaceWriter && surfaceWriter->due(i))
+			surfaceWriter->write(sph, i);
+		++r.stepN;
+		bool sample = r.stepN % sampling == 0 || r.stepN == stepN;
+		if(!sample && !exporter)
+			continue;
+		sph.getParticles(pos, vel);
+		sph.getDensities(density);
+		if(exporter)
+			exporter->publish(pos, vel, density);
+		if(!sample)
+			continue;
+		unsigned fastN;
+		compression += checkState(pos, vel, density, config.Rho0, speedLimit, r, fastN);
+		updateSettling(r, fastN, pos.size(), stepTime);
+		sampleN += pos.size();
+	}
+	r.stepsPerSecond = r.stepN/stepTime;
+	r.simulatedSecondsPerSecond = r.stepsPerSecond*config.Step;
+	r.avgCompression = compression/sampleN;
+	return r;
+}
+
+std::ostream& operator<<(std::ostream& s, const RunResult& r) {
+	return s << "RESULT " << r.stepN << " " << r.stepsPerSecond << " " << r.simulatedSecondsPerSecond << " " << r.maxDensityError << " " << r.avgCompression << " " << r.nan
+		<< " " << r.initTime << " " << r.settledStepN << " " << r.settleTime;
+}
+
+bool parseRunResult(const std::string& line, RunResult& r) {
+	istringstream s(line);
+	string tag;
+	return s >> tag >> r.stepN >> r.stepsPerSecond >> r.simulatedSecondsPerSecond >> r.maxDensityError >> r.avgCompression >> r.nan
+		>> r.initTime >> r.settledStepN >> r.settleTime && tag == "RESULT";
+}
+
+vector<SweepPoint> expandSweeps(const std::vector<Sweep>& sweeps) {
+	vector<SweepPoint> points{{}};
+	for(const Sweep& sw : sweeps) {
+		vector<SweepPoint> expanded;
+		for(const SweepPoint& p : points)
+			for(const string& v : sw.values) {
+				expanded.push_back(p);
+				expanded.back().push_back({sw.key, v});
+			}
+		points = expanded;
+	}
+	return points;
+}
+
+static string shellQuote(const string& s) {
+	string r = "'";
+	for(char c : s) {
+		if(c == '\'')
+			r += "'\\''";
+		else
+			r += c;
+	}
+	return r + "'";
+}
+
+namespace {
+struct Run {
+	SweepPoint point;
+	RunResult result;
+	bool ok;
+	double wallTime; /// [s] whole process incl. initialization
+};
+}
+
+/// writes the summary table to scene.output (CSV) and to stdout
+/// \return false if any of the runs failed or became unstable
+static bool writeSweepTable(const Scene& scene, const vector<Run>& runs) {
+	ostringstream table;
+	for(const Sweep& sw : scene.sweeps)
+		table << sw.key << ",";
+	table << "steps,steps_per_second,simulated_seconds_per_second,max_density_error,avg_compression,nan,init_ms,settled_step,settle_time_s,wall_time_s,status\n";
+	bool allOk = true;
+	for(const Run& run : runs) {
+		for(const auto& kv : run.point)
+			table << kv.second << ",";
+		bool stable = run.ok && !run.result.nan;
+		allOk = allOk && stable;
+		table << run.result.stepN << "," << run.result.stepsPerSecond << "," << run.result.simulatedSecondsPerSecond << ","
+			<< run.result.maxDensityError << "," << run.result.avgCompression << "," << run.result.nan << ","
+			<< run.result.initTime << "," << run.result.settledStepN << "," << run.result.settleTime << "," << run.wallTime << "," << (!run.ok ? "failed" : (run.result.nan ? "unstable" : "ok")) << "\n";
+	}
+	cout << table.str();
+	if(!scene.output.empty()) {
+		ofstream f(scene.output);
+		f << table.str();
+		if(!f) {
+			cerr << "Could not write " << scene.output << endl;
+			return false;
+		}
+	}
+	return allOk;
+}
+
+bool runSweep(const std::string& executable, const std::string& sceneFile, const std::vector<std::string>& extraArgs, const Scene& scene, unsigned jobN) {
+	vector<Run> runs;
+	for(const SweepPoint& p : expandSweeps(scene.sweeps))
+		runs.push_back({p, {}, false, 0});
+	cout << "Sweep: " << runs.size() << " runs, " << jobN << " at once\n";
+
+	atomic<unsigned> next{0};
+	mutex outputMutex;
+	auto worker = [&]() {
+		for(unsigned i = next++; i < runs.size(); i = next++) {
+			Run& run = runs[i];
+			string cmd = shellQuote(executable) + " --scene " + shellQuote(sceneFile);
+			for(const string& a : extraArgs)
+				cmd += " " + shellQuote(a);
+			for(const auto& kv : run.point)
+				cmd += " --set " + shellQuote(kv.first + "=" + kv.second);
+			cmd += " --run 2>&1";
+			auto begin = chrono::steady_clock::now();
+			FILE* child = popen(cmd.c_str(), "r");
+			string output;
+			if(child) {
+				char buf[256];
+				while(fgets(buf, sizeof(buf), child)) {
+					output += buf;
+					run.ok = parseRunResult(buf, run.result) || run.ok;
+				}
+				run.ok = pclose(child) == 0 && run.ok;
+			}
+			run.wallTime = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+			lock_guard<mutex> lock(outputMutex);
+			cout << "run " << i+1 << "/" << runs.size() << (run.ok ? " done" : " FAILED") << endl;
+			if(!run.ok)
+				cerr << cmd << "\n" << output << endl;
+		}
+	};
+	vector<thread> workers;
+	for(unsigned j = 0; j < std::max(1u, jobN); ++j)
+		workers.emplace_back(worker);
+	for(thread& t : workers)
+		t.join();
+	return writeSweepTable(scene, runs);
+}
+
+bool runEnsembleSweep(const Scene& scene, unsigned sampling) {
+	auto begin = chrono::steady_clock::now();
+	vector<Run> runs;
+	vector<SPHconfig> configs;
+	vector<Bounds> bounds;
+	for(const SweepPoint& p : expandSweeps(scene.sweeps)) {
+		Scene member = scene;
+		for(const auto& kv : p)
+			if(!member.set(kv.first, kv.second)) {
+				cerr << "Invalid sweep parameter " << kv.first << "=" << kv.second << endl;
+				return false;
+			}
+		string error = member.validate();
+		if(!error.empty()) {
+			cerr << error << endl;
+			return false;
+		}
+		configs.emplace_back(member.particleN, member.subdivisionN);
+		member.apply(configs.back());
+		bounds.emplace_back(member.boxSize);
+		runs.push_back({p, {0, 0, 0, 0, 0, false, 0, 0, 0}, true, 0});
+	}
+	SPHensemble ensemble(configs, bounds);
+	// the same fresh start as runHeadless, all the members are generated together
+	auto initBegin = chrono::steady_clock::now();
+	ensemble.reset();
+	glFinish();
+	float initTime = chrono::duration<float, milli>(chrono::steady_clock::now() - initBegin).count();
+	for(Run& run : runs)
+		run.result.initTime = initTime;
+	cout << "Ensemble: " << ensemble.memberN() << " simulations, " << ensemble.particleN() << " particles\n";
+
+	// all the members run all the steps, the step count of a member stops when it becomes unstable
+	vector<vec3> pos, vel;
+	vector<float> density;
+	vector<double> compression(runs.size(), 0);
+	vector<unsigned long long> sampleN(runs.size(), 0);
+	vector<double> memberStepTime(runs.size(), 0); // until the member became unstable
+	double stepTime = 0;
+	for(unsigned i = 1; i <= scene.stepN; ++i) {
+		auto stepBegin = chrono::steady_clock::now();
+		ensemble.update();
+		glFinish();
+		stepTime += chrono::duration<double>(chrono::steady_clock::now() - stepBegin).count();
+		bool sampled = (i % sampling == 0 || i == scene.stepN);
+		for(unsigned s = 0; s < runs.size(); ++s) {
+			RunResult& r = runs[s].result;
+			if(r.nan)
+				continue;
+			r.stepN = i;
+			memberStepTime[s] = stepTime;
+			if(!sampled)
+				continue;
+			ensemble.getParticles(s, pos, vel);
+			ensemble.getDensities(s, density);
+			unsigned fastN;
+			compression[s] += checkState(pos, vel, density, configs[s].Rho0, settledSpeed(bounds[s]), r, fastN);
+			updateSettling(r, fastN, pos.size(), stepTime);
+			sampleN[s] += pos.size();
+		}
+	}
+	double wallTime = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+	for(unsigned s = 0; s < runs.size(); ++s) {
+		Run& run = runs[s];
+		run.result.stepsPerSecond = run.result.stepN/memberStepTime[s];
+		run.result.simulatedSecondsPerSecond = run.result.stepsPerSecond*configs[s].Step;
+		run.result.avgCompression = compression[s]/sampleN[s];
+		run.wallTime = wallTime;
+	}
+	cout << "aggregate throughput: " << double(ensemble.particleN())*scene.stepN/stepTime << " particle-steps/s\n";
+	return writeSweepTable(scene, runs);
+}
@@ -0,0 +1,56 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       sweep.hpp
+ * \author     Ales Koblizek
+ * \date       2026/10/19
+ * \brief      Headless runs and the parameter-sweep batch runner
+*/
+//----------------------------------------------------------------------------------------
+#ifndef SWEEP_HPP_26_10_19_11_20_03
+#define SWEEP_HPP_26_10_19_11_20_03 
+#include "scene.hpp"
+#include "sharedState.hpp"
+#include "surface.hpp"
+
+/// Statistics of a single headless run
+struct RunResult {
+	unsigned stepN; /// steps done, the run stops early when it becomes unstable
+	double stepsPerSecond;
+	double simulatedSecondsPerSecond; /// stepsPerSecond*Step
+	float maxDensityError; /// max |density-Rho0|/Rho0 over the sampled steps
+	float avgCompression; /// mean max(density-Rho0,0)/Rho0 over the sampled steps and particles - compares the solvers
+	bool nan; /// NaN or inf found in the particle state
+	float initTime; /// [ms] generation of the initial state at the start of the run
+	unsigned settledStepN; /// from this sampled step on all the particles stayed slower than the free fall over the box height, 0 if never
+	double settleTime; /// [s] initTime and the steps up to settledStepN - time to the first stable step
+};
+
+/// resets the simulation and runs stepN steps, the state is checked every sampling steps and published to the exporter (if set) after every step,
+/// the health metrics of the steps due are written to healthLog (if set), the surface of the steps due to surfaceWriter (if set)
+RunResult runHeadless(SPH& sph, const SPHconfig& config, const Bounds& b, unsigned stepN, unsigned sampling = 10, SharedStateWriter* exporter = nullptr, HealthLog* healthLog = nullptr,
+		SurfaceWriter* surfaceWriter = nullptr);
+
+/// single line "RESULT stepN stepsPerSecond simulatedSecondsPerSecond maxDensityError avgCompression nan initTime settledStepN settleTime" parsed by the sweep runner
+std::ostream& operator<<(std::ostream& s, const RunResult& r);
+bool parseRunResult(const std::string& line, RunResult& r);
+
+/// parameter assignments (key, value) of a single run
+using SweepPoint = std::vector<std::pair<std::string,std::string>>;
+
+/// all the combinations of the swept values
+std::vector<SweepPoint> expandSweeps(const std::vector<Sweep>& sweeps);
+
+/* Runs the scene for every combination of the swept values, each in a separate headless process
+ * (executable --scene sceneFile --set key=value... --run, extraArgs are passed as well), at most jobN at once.
+ * Writes the summary table to scene.output (CSV) and to stdout.
+ * \return false if any of the runs failed or became unstable
+ */
+bool runSweep(const std::string& executable, const std::string& sceneFile, const std::vector<std::string>& extraArgs, const Scene& scene, unsigned jobN);
+
+/* Runs all the combinations of the swept values at once in a single SPHensemble (needs the GL context).
+ * Writes the same table as runSweep, the steps per second and the wall time are shared by all the runs.
+ * \return false if any of the runs became unstable
+ */
+bool runEnsembleSweep(const Scene& scene, unsigned sampling = 10);
+
+#endif /* SWEEP_HPP_26_10_19_11_20_03 */
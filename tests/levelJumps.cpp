@@ -0,0 +1,66 @@
+// Test of the time-step level limit of the local time stepping (limitLevelJumps in sphCpu.cpp):
+// the neighbouring cells must end up at most one level apart, lowered no more than needed.
+// usage: levelJumps
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include "../sphCpu.hpp"
+using namespace std;
+
+static int cellID(int x, int y, int z, int n) {
+	return (x*n + y)*n + z;
+}
+
+/// the levels of a n^3 grid differ at most by one between the neighbours (the 26-neighbourhood)
+static bool jumpsLimited(const vector<unsigned char>& level, int n) {
+	for(int x = 0; x < n; ++x)
+		for(int y = 0; y < n; ++y)
+			for(int z = 0; z < n; ++z)
+				for(int nx = max(0, x-1); nx <= min(n-1, x+1); ++nx)
+					for(int ny = max(0, y-1); ny <= min(n-1, y+1); ++ny)
+						for(int nz = max(0, z-1); nz <= min(n-1, z+1); ++nz)
+							if(level[cellID(x,y,z,n)] > level[cellID(nx,ny,nz,n)] + 1)
+								return false;
+	return true;
+}
+
+int main() {
+	bool passed = true;
+	// the row 3,3,3,0 along x: a single sweep left 3,3,1,0
+	const int n = 4;
+	const unsigned maxLevel = 3;
+	vector<unsigned char> level(n*n*n, maxLevel);
+	level[cellID(3,0,0,n)] = 0;
+	limitLevelJumps(level, n);
+	for(int x = 0; x < n; ++x)
+		for(int y = 0; y < n; ++y)
+			for(int z = 0; z < n; ++z) {
+				// the level grows by one per cell of the Chebyshev distance from the level 0 cell
+				unsigned expected = min<unsigned>(maxLevel, max(max(3-x, y), z));
+				if(level[cellID(x,y,z,n)] != expected) {
+					cerr << "cell " << x << " " << y << " " << z << ": level " << unsigned(level[cellID(x,y,z,n)]) << ", expected " << expected << endl;
+					passed = false;
+				}
+			}
+
+	// random levels: limited, and a level 0 cell stays at 0
+	const int m = 8;
+	srand(1);
+	for(unsigned trial = 0; trial < 100; ++trial) {
+		vector<unsigned char> random(m*m*m);
+		for(unsigned char& l : random)
+			l = rand() % 8;
+		vector<unsigned char> limited = random;
+		limitLevelJumps(limited, m);
+		for(unsigned c = 0; c < limited.size(); ++c)
+			if(limited[c] > random[c] || (random[c] == 0 && limited[c] != 0))
+				passed = false;
+		if(!jumpsLimited(limited, m)) {
+			cerr << "random trial " << trial << ": the neighbouring levels differ by more than one" << endl;
+			passed = false;
+		}
+	}
+	cout << "levelJumps " << (passed ? "passed" : "FAILED") << endl;
+	return passed ? 0 : EXIT_FAILURE;
+}
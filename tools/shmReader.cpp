@@ -0,0 +1,74 @@
+// Sample reader of the state exported by "demo --export name": attaches to the shared memory,
+// reads every new frame in place and measures the latency from the publication to the end of the read.
+// usage: shmReader [name [seconds]]
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../sharedState.hpp"
+using namespace std;
+
+int main(int argc, char* argv[]) {
+	string name = argc > 1 ? argv[1] : "/sph";
+	double seconds = argc > 2 ? stod(argv[2]) : 10;
+	auto end = chrono::steady_clock::now() + chrono::duration<double>(seconds);
+
+	// the simulation may not have started yet
+	unique_ptr<SharedStateReader> reader;
+	while(!(reader = make_unique<SharedStateReader>(name))->valid()) {
+		if(chrono::steady_clock::now() > end) {
+			cerr << "No exported state " << name << endl;
+			return 1;
+		}
+		this_thread::sleep_for(chrono::milliseconds(10));
+	}
+	const SharedStateHeader& info = reader->info();
+	cout << "attached to " << name << ": " << info.particleN << " particles, " << info.frameN << " frames, step " << info.step
+		<< " [s], h " << info.h << ", bounds " << info.boundsMin[0] << " " << info.boundsMin[1] << " " << info.boundsMin[2]
+		<< " - " << info.boundsMax[0] << " " << info.boundsMax[1] << " " << info.boundsMax[2] << endl;
+
+	vector<double> latencies; // [us]
+	unsigned long long missedN = 0, tornN = 0;
+	bool first = true;
+	uint64_t lastStep = 0;
+	double densitySum = 0;
+	while(chrono::steady_clock::now() < end) {
+		SharedFrame frame;
+		if(!reader->latest(frame) || (!first && frame.step == lastStep)) {
+			this_thread::yield();
+			continue;
+		}
+		// the analysis works on the mapped frame directly
+		double sum = 0;
+		for(unsigned p = 0; p < info.particleN; ++p)
+			sum += frame.density[p];
+		int64_t readTime = monotonicNanoseconds();
+		if(!reader->stillValid(frame)) {
+			++tornN;
+			continue;
+		}
+		if(!first)
+			missedN += frame.step - lastStep - 1;
+		first = false;
+		lastStep = frame.step;
+		densitySum = sum;
+		latencies.push_back((readTime - frame.publishTime)/1000.);
+	}
+	if(latencies.empty()) {
+		cout << "no frames\n";
+		return 1;
+	}
+	sort(latencies.begin(), latencies.end());
+	double avg = 0;
+	for(double l : latencies)
+		avg += l;
+	avg /= latencies.size();
+	cout << "frames read: " << latencies.size() << ", skipped: " << missedN << ", torn (retried): " << tornN << "\n"
+		<< "latency [us]: min " << latencies.front() << ", avg " << avg << ", median " << latencies[latencies.size()/2]
+		<< ", p99 " << latencies[min(latencies.size()-1, latencies.size()*99/100)] << ", max " << latencies.back() << "\n"
+		<< "mean density of the last frame: " << densitySum/info.particleN << endl;
+	return 0;
+}
@@ -0,0 +1,123 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "transport.hpp"
+using namespace std;
+
+void Transport::exchange(unsigned peer, const std::vector<char>& out, std::vector<char>& in) {
+	if(rank() < peer) {
+		send(peer, out);
+		receive(peer, in);
+	}
+	else {
+		receive(peer, in);
+		send(peer, out);
+	}
+}
+
+unique_ptr<LocalTransport> LocalTransport::spawn(unsigned processN) {
+	// pairs[a][b] is the socket of a connected to b
+	vector<vector<int>> pairs(processN, vector<int>(processN, -1));
+	for(unsigned a = 0; a < processN; ++a)
+		for(unsigned b = a+1; b < processN; ++b) {
+			int s[2];
+			if(socketpair(AF_UNIX, SOCK_STREAM, 0, s) != 0)
+				return nullptr;
+			pairs[a][b] = s[0];
+			pairs[b][a] = s[1];
+		}
+	vector<pid_t> children;
+	unsigned rank = 0;
+	for(unsigned r = 1; r < processN; ++r) {
+		pid_t pid = fork();
+		if(pid < 0)
+			return nullptr;
+		if(pid == 0) {
+			rank = r;
+			children.clear();
+			break;
+		}
+		children.push_back(pid);
+	}
+	// keep only the sockets of this rank
+	for(unsigned a = 0; a < processN; ++a)
+		if(a != rank)
+			for(int s : pairs[a])
+				if(s >= 0)
+					close(s);
+	unique_ptr<LocalTransport> t(new LocalTransport(rank, std::move(pairs[rank])));
+	t->children = std::move(children);
+	return t;
+}
+
+LocalTransport::~LocalTransport() {
+	for(int s : sockets)
+		if(s >= 0)
+			close(s);
+	wait();
+}
+
+bool LocalTransport::wait() {
+	bool ok = true;
+	for(pid_t pid : children) {
+		int status;
+		pid_t r;
+		while((r = waitpid(pid, &status, 0)) < 0 && errno == EINTR)
+			;
+		if(r < 0) {
+			cerr << "LocalTransport: waiting for the process " << pid << " failed: " << strerror(errno) << endl;
+			ok = false;
+			continue;
+		}
+		ok = ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	}
+	children.clear();
+	return ok;
+}
+
+/// the whole buffer, the stream sockets may transfer it in parts
+static void writeAll(int socket, const char* data, size_t size) {
+	while(size > 0) {
+		ssize_t n = ::send(socket, data, size, MSG_NOSIGNAL); // no SIGPIPE from a dead peer
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0) {
+			cerr << "LocalTransport: the peer closed the connection\n";
+			exit(EXIT_FAILURE);
+		}
+		data += n;
+		size -= n;
+	}
+}
+
+static void readAll(int socket, char* data, size_t size) {
+	while(size > 0) {
+		ssize_t n = read(socket, data, size);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0) {
+			cerr << "LocalTransport: the peer closed the connection\n";
+			exit(EXIT_FAILURE);
+		}
+		data += n;
+		size -= n;
+	}
+}
+
+void LocalTransport::send(unsigned to, const std::vector<char>& message) {
+	uint64_t size = message.size();
+	writeAll(sockets[to], reinterpret_cast<const char*>(&size), sizeof(size));
+	writeAll(sockets[to], message.data(), message.size());
+}
+
+void LocalTransport::receive(unsigned from, std::vector<char>& message) {
+	uint64_t size;
+	readAll(sockets[from], reinterpret_cast<char*>(&size), sizeof(size));
+	message.resize(size);
+	readAll(sockets[from], message.data(), size);
+}
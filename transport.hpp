@@ -0,0 +1,57 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       transport.hpp
+ * \author     Ales Koblizek
+ * \date       2026/10/19
+ * \brief      Message passing between the processes of a decomposed simulation
+*/
+//----------------------------------------------------------------------------------------
+#ifndef TRANSPORT_HPP_26_10_19_13_05_12
+#define TRANSPORT_HPP_26_10_19_13_05_12
+#include <memory>
+#include <vector>
+#include <sys/types.h>
+
+/* Blocking point-to-point messages between the ranks 0..size()-1.
+ * The messages between two ranks arrive in the order they were sent.
+ */
+class Transport {
+	public:
+		virtual ~Transport() = default;
+
+		virtual unsigned rank() const = 0;
+		virtual unsigned size() const = 0;
+		virtual void send(unsigned to, const std::vector<char>& message) = 0;
+		virtual void receive(unsigned from, std::vector<char>& message) = 0;
+
+		/// send to and receive from the peer, the lower rank sends first so that two ranks exchanging with each other do not deadlock
+		void exchange(unsigned peer, const std::vector<char>& out, std::vector<char>& in);
+};
+
+/* Processes forked on this machine, each pair of them connected by a Unix domain socket pair.
+ * The rank 0 stays in the calling process and waits for the other ranks in the destructor.
+ */
+class LocalTransport: public Transport {
+	public:
+		/// forks processN-1 children (the caller should flush its output first)
+		/// \return the transport of the rank of the calling process (a child returns with its own rank), null if the sockets or the processes cannot be created
+		static std::unique_ptr<LocalTransport> spawn(unsigned processN);
+		~LocalTransport();
+
+		unsigned rank() const override { return r; }
+		unsigned size() const override { return sockets.size(); }
+		void send(unsigned to, const std::vector<char>& message) override;
+		void receive(unsigned from, std::vector<char>& message) override;
+		/// rank 0: waits for the other ranks
+		/// \return true if all of them exited successfully
+		bool wait();
+
+	private:
+		LocalTransport(unsigned _r, std::vector<int>&& _sockets): r{_r}, sockets{std::move(_sockets)} {}
+
+		unsigned r;
+		std::vector<int> sockets; /// per rank, -1 for itself
+		std::vector<pid_t> children; /// rank 0: the processes of the ranks 1..
+};
+
+#endif /* TRANSPORT_HPP_26_10_19_13_05_12 */
@@ -3,6 +3,11 @@
 #include <fstream>
 #include <cstddef>
 #include <cassert>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <sstream>
 #include <GL/glew.h>
 #include <glm/gtc/random.hpp>
 #include "utils.hpp"
@@ -44,56 +49,258 @@ std::string fileAsString(std::string fileName) {
 	return s;
 }
 
-GLuint loadShaderObject(std::string fileName, GLenum shaderType) {
-	GLuint shaderObject = glCreateShader(shaderType);
-	if(shaderObject) {
-		std::string f = fileAsString(fileName);
-		GLint l = f.length();
-		if(l != 0) {
-			const GLchar* strs = f.c_str();
-			glShaderSource(shaderObject, 1, &strs, &l);
+std::string programBinaryCacheDir;
+
+void setProgramBinaryCacheDir(std::string dir) {
+	programBinaryCacheDir = dir;
+	if(!dir.empty()) {
+		std::error_code ec;
+		filesystem::create_directories(dir, ec);
+		if(ec) {
+			cerr << "Cannot create program binary cache directory " << dir << ": " << ec.message() << endl;
+			programBinaryCacheDir.clear();
+		}
+	}
+}
+
+const std::string& getProgramBinaryCacheDir() {
+	return programBinaryCacheDir;
+}
+
+uint64_t hashString(const std::string& s) {
+	uint64_t h = 14695981039346656037ull;
+	for(unsigned char c : s) {
+		h ^= c;
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+std::string driverString() {
+	std::string s;
+	for(GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+		const GLubyte* str = glGetString(name);
+		if(str)
+			s += (const char*)str;
+		s += '\n';
+	}
+	return s;
+}
+
+bool programBinaryCacheEnabled() {
+	if(programBinaryCacheDir.empty())
+		return false;
+	GLint formatN = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatN);
+	return formatN > 0;
+}
+
+std::string programBinaryCachePath(const std::string& key) {
+	ostringstream path;
+	path << programBinaryCacheDir << "/" << hex << setw(16) << setfill('0') << hashString(key) << ".bin";
+	return path.str();
+}
+
+/// Tries to load the program from the binary cache, the whole key is stored in the file to detect hash collisions
+bool loadProgramBinary(GLuint program, const std::string& key) {
+	std::string path = programBinaryCachePath(key);
+	std::ifstream f(path, std::ios::binary | std::ios::ate);
+	if(!f)
+		return false;
+	// the lengths stored in the file are checked against its size before anything is allocated
+	uint64_t fileL = f.tellg();
+	f.seekg(0);
+	uint32_t keyL = 0, binaryL = 0;
+	GLenum format = 0;
+	std::string storedKey;
+	std::vector<char> binary;
+	const uint64_t headerL = sizeof(keyL) + sizeof(format) + sizeof(binaryL);
+	f.read((char*)&keyL, sizeof(keyL));
+	bool valid = f && headerL + keyL <= fileL;
+	if(valid) {
+		storedKey.resize(keyL);
+		f.read(&storedKey[0], keyL);
+		f.read((char*)&format, sizeof(format));
+		f.read((char*)&binaryL, sizeof(binaryL));
+		valid = f && headerL + keyL + binaryL == fileL;
+	}
+	if(valid) {
+		binary.resize(binaryL);
+		f.read(binary.data(), binaryL);
+		valid = bool(f);
+	}
+	if(!valid) {
+		// truncated or corrupt file
+		cerr << "Discarding corrupt program binary " << path << endl;
+		f.close();
+		std::error_code ec;
+		filesystem::remove(path, ec);
+		return false;
+	}
+	if(storedKey != key)
+		return false;
+	glProgramBinary(program, format, binary.data(), binaryL);
+	GLint r;
+	glGetProgramiv(program, GL_LINK_STATUS, &r);
+	if(r != GL_TRUE) {
+		// e.g. driver update which kept the version string - fall back to the source
+		cerr << "Discarding stale program binary " << path << endl;
+		filesystem::remove(path);
+		return false;
+	}
+	return true;
+}
+
+void storeProgramBinary(GLuint program, const std::string& key) {
+	GLint binaryL = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &binaryL);
+	if(binaryL <= 0)
+		return;
+	std::vector<char> binary(binaryL);
+	GLenum format;
+	glGetProgramBinary(program, binaryL, &binaryL, &format, binary.data());
+	std::string path = programBinaryCachePath(key);
+	// write to a temporary file first so that a concurrently starting process never reads a partial binary
+	std::string tmpPath = path + ".tmp" + std::to_string(chrono::steady_clock::now().time_since_epoch().count());
+	{
+		std::ofstream f(tmpPath, std::ios::binary);
+		uint32_t keyL = key.size();
+		uint32_t bL = binaryL;
+		f.write((char*)&keyL, sizeof(keyL));
+		f.write(key.data(), keyL);
+		f.write((char*)&format, sizeof(format));
+		f.write((char*)&bL, sizeof(bL));
+		f.write(binary.data(), bL);
+		if(!f) {
+			cerr << "Could not write program binary " << tmpPath << endl;
+			return;
+		}
+	}
+	std::error_code ec;
+	filesystem::rename(tmpPath, path, ec);
+	if(ec)
+		filesystem::remove(tmpPath, ec);
+}
+
+std::string glslFloat(float v) {
+	ostringstream s;
+	s << scientific << setprecision(9) << v;
+	return s.str();
+}
+
+/// inserts the defines right after the #version directive, #line keeps the line numbers of compile errors matching the file
+std::string injectDefines(const std::string& source, const std::vector<std::string>& defines) {
+	if(defines.empty())
+		return source;
+	size_t versionPos = source.find("#version");
+	if(versionPos == std::string::npos)
+		versionPos = 0;
+	size_t lineEnd = source.find('\n', versionPos);
+	if(lineEnd == std::string::npos)
+		return source;
+	unsigned versionLine = std::count(source.begin(), source.begin()+lineEnd, '\n') + 1;
+	std::string s = source.substr(0, lineEnd+1);
+	for(const std::string& d : defines)
+		s += "#define " + d + "\n";
+	s += "#line " + std::to_string(versionLine + 1) + "\n";
+	s += source.substr(lineEnd+1);
+	return s;
+}
+
+bool shaderCompiled(GLuint shaderObject, const std::string& fileName) {
+	GLint r;
+	glGetShaderiv(shaderObject, GL_COMPILE_STATUS, &r);
+	if(r != GL_TRUE) {
+		char buf[1000];
+		GLsizei l;
+		glGetShaderInfoLog(shaderObject, sizeof(buf), &l, buf);
+		cerr << fileName << ":\n" << buf << endl;
+	}
+	return r == GL_TRUE;
+}
+
+bool programLinked(GLuint program) {
+	GLint r;
+	glGetProgramiv(program, GL_LINK_STATUS, &r);
+	if(r != GL_TRUE) {
+		char buf[1000];
+		GLsizei l;
+		glGetProgramInfoLog(program, sizeof(buf), &l, buf);
+		cerr << buf << endl;
+	}
+	return r == GL_TRUE;
+}
+
+GLuint loadShaderProgram(std::vector<std::tuple<GLenum,std::string>> shaderFiles, std::vector<std::string> defines) {
+	return loadShaderPrograms({{shaderFiles, defines}})[0];
+}
+
+std::vector<GLuint> loadShaderPrograms(const std::vector<ShaderProgramSource>& programs) {
+	auto start = chrono::steady_clock::now();
+	// programs not found in the cache, waiting for compilation
+	struct Pending {
+		unsigned i;
+		std::string key;
+		std::vector<std::tuple<GLuint,std::string>> shaders;
+	};
+	std::vector<Pending> pending;
+	std::vector<GLuint> r(programs.size(), 0);
+	bool cacheEnabled = programBinaryCacheEnabled();
+	std::string driver = driverString();
+	if(GLEW_KHR_parallel_shader_compile)
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+
+	unsigned cachedN = 0;
+	for(unsigned i = 0; i < programs.size(); ++i) {
+		std::vector<std::string> sources;
+		std::string key = driver;
+		for(const auto& sf: programs[i].files) {
+			sources.push_back(injectDefines(fileAsString(std::get<1>(sf)), programs[i].defines));
+			key += std::to_string(std::get<0>(sf)) + "\n" + sources.back();
+		}
+		r[i] = glCreateProgram();
+		if(!r[i])
+			continue;
+		if(cacheEnabled && loadProgramBinary(r[i], key)) {
+			++cachedN;
+			continue;
+		}
+		// only start the compilation here, the status is queried once all programs are submitted, so the driver can compile them in parallel
+		Pending p{i, key, {}};
+		for(unsigned s = 0; s < programs[i].files.size(); ++s) {
+			GLuint shaderObject = glCreateShader(std::get<0>(programs[i].files[s]));
+			const GLchar* str = sources[s].c_str();
+			GLint l = sources[s].length();
+			glShaderSource(shaderObject, 1, &str, &l);
 			glCompileShader(shaderObject);
-			GLint r;
-			glGetShaderiv(shaderObject, GL_COMPILE_STATUS, &r);
-			if(r == GL_TRUE) {
-				return shaderObject;
-			}
-			else {
-				char buf[1000];
-				GLsizei l;
-				glGetShaderInfoLog(shaderObject, sizeof(buf), &l, buf);
-				cerr << buf << endl;
-			}
+			glAttachShader(r[i], shaderObject);
+			p.shaders.push_back(std::make_tuple(shaderObject, std::get<1>(programs[i].files[s])));
 		}
+		if(cacheEnabled)
+			glProgramParameteri(r[i], GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(r[i]);
+		pending.push_back(p);
 	}
-	return 0;
-}
-
-GLuint loadShaderProgram(std::vector<std::tuple<GLenum,std::string>> shaderFiles) {
-	GLuint shaderProgram = glCreateProgram();
-	if(shaderProgram) {
-		for(const auto& sf: shaderFiles) {
-			GLuint shaderObject = loadShaderObject(std::get<1>(sf), std::get<0>(sf));
-			if(shaderObject) {
-				glAttachShader(shaderProgram, shaderObject);
-			}
-			else
-				return 0; // FIXME probabble shaderObject leak
+
+	for(const Pending& p : pending) {
+		bool ok = true;
+		for(const auto& s : p.shaders) {
+			ok = shaderCompiled(std::get<0>(s), std::get<1>(s)) && ok;
+			glDetachShader(r[p.i], std::get<0>(s));
+			glDeleteShader(std::get<0>(s));
 		}
-		glLinkProgram(shaderProgram);
-		GLint r;
-		glGetProgramiv(shaderProgram, GL_LINK_STATUS, &r);
-		if(r == GL_TRUE) {
-			return shaderProgram;
+		if(ok && programLinked(r[p.i])) {
+			if(cacheEnabled)
+				storeProgramBinary(r[p.i], p.key);
 		}
 		else {
-			char buf[1000];
-			GLsizei l;
-			glGetProgramInfoLog(shaderProgram, sizeof(buf), &l, buf);
-			cerr << buf << endl;
+			glDeleteProgram(r[p.i]);
+			r[p.i] = 0;
 		}
 	}
-	return 0;
+	double t = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	cout << "Loaded " << programs.size() << " shader program(s) (" << cachedN << " from binary cache) in " << t << " ms\n";
+	return r;
 }
 
 //source: https://blog.nobel-joergensen.com/2013/02/17/debugging-opengl-part-2-using-gldebugmessagecallback/
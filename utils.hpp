@@ -39,7 +39,30 @@ std::istream& operator>>(std::istream& s, glm::vec3& v);
 
 void setUniform(GLuint program, const glm::mat4x4& m, std::string name);
 
-GLuint loadShaderProgram(std::vector<std::tuple<GLenum,std::string>> shaderFiles);
+/// shader files forming a single program: (shader type, file name)
+using ShaderFiles = std::vector<std::tuple<GLenum,std::string>>;
+
+/// Shader program variant - the shader files and the preprocessor definitions ("NAME value") injected into each of them
+struct ShaderProgramSource {
+	ShaderFiles files;
+	std::vector<std::string> defines;
+};
+
+/// Linked programs are cached in this directory as binaries (keyed by the source, the defines and the driver), empty string disables the cache
+void setProgramBinaryCacheDir(std::string dir);
+const std::string& getProgramBinaryCacheDir();
+/// 64-bit FNV-1a hash
+uint64_t hashString(const std::string& s);
+/// GL vendor, renderer and version - identifies the driver
+std::string driverString();
+
+/// formats the value as a GLSL float literal which keeps full precision, to be used in defines
+std::string glslFloat(float v);
+
+GLuint loadShaderProgram(std::vector<std::tuple<GLenum,std::string>> shaderFiles, std::vector<std::string> defines = {});
+/// Loads several programs at once, all the programs which are not in the binary cache are compiled together (in parallel if the driver supports it)
+/// \return program names in the same order as programs, 0 for the programs which failed to compile or link
+std::vector<GLuint> loadShaderPrograms(const std::vector<ShaderProgramSource>& programs);
 
 void openglCallbackFunction(GLenum source,
 		GLenum type,
@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include "validation.hpp"
+using namespace std;
+
+std::ostream& operator<<(std::ostream& s, const ValidationReport& r) {
+	return s << "step " << r.step << (r.passed ? " OK" : " FAILED")
+		<< " - position max/rms: " << r.maxPositionError << "/" << r.rmsPositionError
+		<< ", velocity max/rms: " << r.maxVelocityError << "/" << r.rmsVelocityError
+		<< ", density max/rms: " << r.maxDensityError << "/" << r.rmsDensityError
+		<< ", cell record mismatches: " << r.cellRecordMismatchN
+		<< ", unmatched particles: " << r.unmatchedN
+		<< ", step time ratio: " << r.stepTimeRatio;
+}
+
+LockstepValidator::LockstepValidator(SPH& _reference, SPH& _tested, unsigned _comparePeriod, ValidationTolerances _tolerances):
+	lastReport{}, reference{_reference}, tested{_tested}, comparePeriod{_comparePeriod}, tolerances{_tolerances}, stepN{0}, referenceTime{0}, testedTime{0}
+{
+	synchronize();
+}
+
+bool LockstepValidator::step() {
+	// glFinish makes the wall time include the GPU work
+	auto begin = chrono::steady_clock::now();
+	reference.update();
+	glFinish();
+	auto referenceEnd = chrono::steady_clock::now();
+	tested.update();
+	glFinish();
+	auto testedEnd = chrono::steady_clock::now();
+	referenceTime += chrono::duration<double>(referenceEnd - begin).count();
+	testedTime += chrono::duration<double>(testedEnd - referenceEnd).count();
+	++stepN;
+	if(stepN % comparePeriod != 0)
+		return false;
+	compare();
+	synchronize();
+	return true;
+}
+
+void LockstepValidator::synchronize() {
+	vector<vec3> pos, vel;
+	reference.getParticles(pos, vel);
+	reference.getParticleIDs(synchronizedIDs);
+	tested.setParticles(pos, vel);
+}
+
+void LockstepValidator::compare() {
+	vector<vec3> refPos, refVel, testPos, testVel;
+	vector<float> refDensity, testDensity;
+	vector<CellRecord> refCells, testCells;
+	vector<unsigned> refIDs, testIDs;
+	reference.getParticles(refPos, refVel);
+	reference.getParticleIDs(refIDs);
+	reference.getDensities(refDensity);
+	reference.getCellRecords(refCells);
+	tested.getParticles(testPos, testVel);
+	tested.getParticleIDs(testIDs);
+	tested.getDensities(testDensity);
+	tested.getCellRecords(testCells);
+
+	ValidationReport r{};
+	r.step = stepN;
+	r.stepTimeRatio = referenceTime/testedTime;
+	for(unsigned c = 0; c < refCells.size(); ++c)
+		if(refCells[c].particleN != testCells[c].particleN)
+			++r.cellRecordMismatchN;
+
+	// the implementations order the particles differently, they are paired by the IDs,
+	// the tested ones count from the last synchronization
+	const unsigned none = numeric_limits<unsigned>::max();
+	vector<unsigned> refIndex(refPos.size(), none);
+	for(unsigned j = 0; j < refIDs.size(); ++j)
+		if(refIDs[j] < refIndex.size())
+			refIndex[refIDs[j]] = j;
+	vector<bool> paired(refPos.size(), false);
+	double positionSq = 0, velocitySq = 0, densitySq = 0;
+	unsigned matchedN = 0;
+	for(unsigned i = 0; i < testPos.size(); ++i) {
+		unsigned j = testIDs[i] < synchronizedIDs.size() && synchronizedIDs[testIDs[i]] < refIndex.size() ? refIndex[synchronizedIDs[testIDs[i]]] : none;
+		if(j == none || paired[j]) {
+			++r.unmatchedN;
+			continue;
+		}
+		paired[j] = true;
+		++matchedN;
+		float positionError = length(testPos[i] - refPos[j]);
+		float velocityError = length(testVel[i] - refVel[j]);
+		float densityError = fabs(testDensity[i] - refDensity[j])/refDensity[j];
+		// NaN never compares greater, it has to be propagated explicitly
+		auto accumulate = [](float e, float& maxE, double& sumSq) {
+			maxE = (std::isnan(e) || e > maxE) ? e : maxE;
+			sumSq += double(e)*e;
+		};
+		accumulate(positionError, r.maxPositionError, positionSq);
+		accumulate(velocityError, r.maxVelocityError, velocitySq);
+		accumulate(densityError, r.maxDensityError, densitySq);
+	}
+	unsigned n = std::max(matchedN, 1u);
+	r.rmsPositionError = sqrt(positionSq/n);
+	r.rmsVelocityError = sqrt(velocitySq/n);
+	r.rmsDensityError = sqrt(densitySq/n);
+	r.passed = r.unmatchedN == 0 && testPos.size() == refPos.size()
+		&& r.cellRecordMismatchN <= tolerances.cellRecords*refCells.size()
+		&& r.rmsPositionError <= tolerances.position
+		&& r.rmsVelocityError <= tolerances.velocity
+		&& r.rmsDensityError <= tolerances.density;
+	lastReport = r;
+}
@@ -0,0 +1,70 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       validation.hpp
+ * \author     Ales Koblizek
+ * \date       2026/10/19
+ * \brief      Lockstep comparison of two SPH implementations
+*/
+//----------------------------------------------------------------------------------------
+#ifndef VALIDATION_HPP_26_10_19_10_05_12
+#define VALIDATION_HPP_26_10_19_10_05_12 
+#include "sph.hpp"
+
+/// Maximal allowed differences of the tested implementation from the reference.
+/// They apply to the RMS errors, single particles near a wall or a cell boundary can legitimately diverge more.
+struct ValidationTolerances {
+	float position = 1e-3; /// [m]
+	float velocity = 1e-2; /// [m/s]
+	float density = 1e-3; /// relative to the reference density
+	float cellRecords = 0.01; /// fraction of cells whose particle count differs
+};
+
+/// Differences found by a single comparison
+struct ValidationReport {
+	unsigned step;
+	float maxPositionError;
+	float rmsPositionError;
+	float maxVelocityError;
+	float rmsVelocityError;
+	float maxDensityError; /// relative
+	float rmsDensityError; /// relative
+	unsigned cellRecordMismatchN; /// number of cells whose particle count differs
+	unsigned unmatchedN; /// tested particles without a reference particle of the same ID (lost or duplicated), not in the errors above
+	double stepTimeRatio; /// reference step time / tested step time
+	bool passed;
+};
+
+std::ostream& operator<<(std::ostream& s, const ValidationReport& r);
+
+/* Runs two implementations in lockstep from an identical state.
+ * Every comparePeriod steps their states are compared particle by particle (paired by SPH::getParticleIDs), the tested implementation
+ * is then reset to the state of the reference one, so the errors do not accumulate
+ * over the whole run (the simulation is chaotic).
+ */
+class LockstepValidator {
+	public:
+		LockstepValidator(SPH& reference, SPH& tested, unsigned comparePeriod, ValidationTolerances tolerances);
+
+		/// advances both implementations by a single step
+		/// \return true if the implementations were compared in this step
+		bool step();
+
+		ValidationReport lastReport;
+
+	private:
+		/// copies the state of the reference implementation to the tested one
+		void synchronize();
+		void compare();
+
+	private:
+		SPH& reference;
+		SPH& tested;
+		unsigned comparePeriod;
+		ValidationTolerances tolerances;
+		unsigned stepN;
+		double referenceTime;
+		double testedTime;
+		std::vector<unsigned> synchronizedIDs; /// reference IDs of the particles at the last synchronization, the tested IDs index it
+};
+
+#endif /* VALIDATION_HPP_26_10_19_10_05_12 */